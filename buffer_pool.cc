@@ -0,0 +1,72 @@
+/*
+ * Recycling pool for message body buffers.
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool(size_t min_size, size_t max_size) :
+   m_min_size(min_size),
+   m_max_size(max_size)
+{
+   m_free.resize(class_index(m_max_size) + 1);
+   // reserve list slots up front so releasing never allocates either
+   for( auto& list : m_free ) {
+      list.reserve(4);
+   }
+}
+
+buffer_pool::~buffer_pool()
+{
+   for( auto& list : m_free ) {
+      for( uint8_t* buf : list ) {
+         delete[] buf;
+      }
+      list.clear();
+   }
+}
+
+size_t buffer_pool::class_index(size_t size) const
+{
+   size_t idx = 0;
+   size_t cap = m_min_size;
+   while( cap < size ) {
+      cap <<= 1;
+      ++idx;
+   }
+   return idx;
+}
+
+uint8_t* buffer_pool::acquire(size_t size)
+{
+   if( size > m_max_size ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Requested buffer exceeds pool maximum: " + std::to_string(size) );
+   }
+
+   size_t idx = class_index(size);
+   uint8_t* buf;
+   if( !m_free[idx].empty() ) {
+      buf = m_free[idx].back();
+      m_free[idx].pop_back();
+      ++m_stats.reuses;
+   } else {
+      size_t cap = m_min_size << idx;
+      buf = new uint8_t[cap];
+      ++m_stats.heap_allocations;
+      m_stats.heap_bytes += cap;
+   }
+   ++m_stats.outstanding;
+   return buf;
+}
+
+void buffer_pool::release(uint8_t* buf, size_t size)
+{
+   if( NULL == buf ) {
+      return;
+   }
+   m_free[class_index(size)].push_back(buf);
+   --m_stats.outstanding;
+}
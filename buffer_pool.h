@@ -0,0 +1,49 @@
+/*
+ * Recycling pool for message body buffers.
+ *
+ * Buffers are handed out in power-of-two size classes between min_size and
+ * max_size and kept on per-class free lists when released, so a steady
+ * stream of similarly sized messages stops touching the heap once each
+ * class it needs has been allocated once.
+ *
+ * Not thread safe; intended to be owned by a single receiving thread.
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class buffer_pool {
+public:
+   struct alloc_stats {
+      uint64_t heap_allocations = 0; // acquires that had to call new[]
+      uint64_t reuses = 0;           // acquires served from a free list
+      uint64_t outstanding = 0;      // buffers currently handed out
+      uint64_t heap_bytes = 0;       // total bytes ever allocated
+   };
+
+   buffer_pool(size_t min_size, size_t max_size);
+   ~buffer_pool();
+
+   buffer_pool(const buffer_pool&) = delete;
+   buffer_pool& operator=(const buffer_pool&) = delete;
+
+   // Returns a buffer of at least size bytes; size must not exceed max_size.
+   uint8_t* acquire(size_t size);
+   // Returns a buffer to the pool; size must be the value passed to acquire().
+   void release(uint8_t* buf, size_t size);
+
+   const alloc_stats& get_stats() const { return m_stats; }
+
+private:
+   size_t class_index(size_t size) const;
+
+   size_t m_min_size;
+   size_t m_max_size;
+   std::vector< std::vector<uint8_t*> > m_free;
+   alloc_stats m_stats;
+};
+
+#endif /* BUFFER_POOL_H */
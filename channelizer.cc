@@ -0,0 +1,302 @@
+/*
+ * Polyphase filterbank channelizer for interleaved complex float samples.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "channelizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHANNELIZER_X86 1
+#endif
+
+// input samples taken per pass of process(); bounds the batch buffers
+static const size_t ChunkSamples = 16384;
+
+namespace {
+
+// The polyphase sum: out[i] = sum over p < branches of x[p * stride + i] *
+// h[p * stride + i], for count floats; count is a multiple of 4
+
+void presum_scalar(const float* x, const float* h, float* out, size_t count, size_t stride, uint32_t branches)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      float acc = 0;
+      for( uint32_t p = 0; p < branches; ++p ) {
+         acc += x[p * stride + i] * h[p * stride + i];
+      }
+      out[i] = acc;
+   }
+}
+
+#ifdef CHANNELIZER_X86
+
+__attribute__((target("sse2")))
+void presum_sse2(const float* x, const float* h, float* out, size_t count, size_t stride, uint32_t branches)
+{
+   for( size_t i = 0; i < count; i += 4 ) {
+      __m128 acc = _mm_setzero_ps();
+      for( uint32_t p = 0; p < branches; ++p ) {
+         acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + p * stride + i), _mm_loadu_ps(h + p * stride + i)));
+      }
+      _mm_storeu_ps(out + i, acc);
+   }
+}
+
+__attribute__((target("avx2")))
+void presum_avx2(const float* x, const float* h, float* out, size_t count, size_t stride, uint32_t branches)
+{
+   size_t i = 0;
+   for( ; i + 8 <= count; i += 8 ) {
+      __m256 acc = _mm256_setzero_ps();
+      for( uint32_t p = 0; p < branches; ++p ) {
+         acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + p * stride + i),
+                                                _mm256_loadu_ps(h + p * stride + i)));
+      }
+      _mm256_storeu_ps(out + i, acc);
+   }
+   if( i < count ) {
+      presum_sse2(x + i, h + i, out + i, count - i, stride, branches);
+   }
+}
+
+#define PRESUM_VARIANTS presum_avx2, presum_sse2, presum_scalar
+
+#else
+
+#define PRESUM_VARIANTS NULL, NULL, presum_scalar
+
+#endif
+
+typedef void (*presum_fn)(const float*, const float*, float*, size_t, size_t, uint32_t);
+
+presum_fn select_presum(presum_fn avx2, presum_fn sse2, presum_fn scalar)
+{
+#ifdef CHANNELIZER_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+void presum(const float* x, const float* h, float* out, size_t count, size_t stride, uint32_t branches)
+{
+   static const presum_fn impl = select_presum(PRESUM_VARIANTS);
+   impl(x, h, out, count, stride, branches);
+}
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x)
+{
+   double sum = 1;
+   double term = 1;
+   for( int k = 1; k < 50; ++k ) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+      if( term < sum * 1e-17 ) {
+         break;
+      }
+   }
+   return sum;
+}
+
+} // namespace
+
+const uint32_t pfb_channelizer::TapsPerBranch;
+
+pfb_channelizer::pfb_channelizer(double input_rate, uint32_t channels, unsigned threads) :
+   m_input_rate(input_rate),
+   m_channels(channels),
+   m_hop(channels / 2),
+   m_length(TapsPerBranch * channels),
+   m_fft(channels),
+   m_pending_len(0),
+   m_frame(0),
+   m_batch_frames(0),
+   m_shares(threads + 1),
+   m_generation(0),
+   m_finished(0),
+   m_stopping(false)
+{
+   if( !(input_rate > 0) ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " + "Sample rate must be positive" );
+   }
+
+   // Kaiser-windowed sinc with its -6 dB point one channel spacing out:
+   // flat to about 0.75 spacings and down ~90 dB from 1.25, where the
+   // first image of the 2x output rate would land inside +-0.75
+   const double attenuation = 90;
+   const double beta = 0.1102 * (attenuation - 8.7);
+   const double cutoff = 1.0 / channels;  // cycles per input sample
+   const double center = (m_length - 1) / 2.0;
+   std::vector<double> h(m_length);
+   double sum = 0;
+   for( uint32_t r = 0; r < m_length; ++r ) {
+      double t = r - center;
+      double sinc = t == 0 ? 1.0 : std::sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+      double x = t / center;
+      h[r] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - x * x))) / bessel_i0(beta);
+      sum += h[r];
+   }
+   m_prototype.resize(m_length * 2);
+   for( uint32_t r = 0; r < m_length; ++r ) {
+      m_prototype[r * 2] = m_prototype[r * 2 + 1] = (float)(h[r] / sum);
+   }
+
+   m_pending.resize((m_length + ChunkSamples) * 2);
+   m_scratch.resize(channels * 2);
+
+   for( unsigned t = 0; t < threads; ++t ) {
+      m_threads.push_back(new std::thread(&pfb_channelizer::worker_loop, this, t + 1));
+   }
+}
+
+pfb_channelizer::~pfb_channelizer()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stopping = true;
+   }
+   m_start.notify_all();
+   for( std::thread* t : m_threads ) {
+      t->join();
+      delete t;
+   }
+}
+
+size_t pfb_channelizer::add_output(double offset)
+{
+   if( !(std::fabs(offset) < m_input_rate / 2) ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " + "Channel offset " +
+                                std::to_string(offset) + " Hz is outside the input band" );
+   }
+   long k = std::lround(offset / spacing());
+   output_info out;
+   out.channel = (uint32_t)((k + m_channels) % m_channels);
+   out.step = -2 * M_PI * (offset - k * spacing()) / output_rate();
+   out.phase = 0;
+   m_outputs.push_back(out);
+   return m_outputs.size() - 1;
+}
+
+size_t pfb_channelizer::process(const float* in, size_t in_samples)
+{
+   const size_t outputs = m_outputs.size();
+   size_t produced = 0;
+   while( in_samples > 0 ) {
+      size_t n = std::min(in_samples, ChunkSamples);
+      memcpy(&m_pending[m_pending_len * 2], in, n * 2 * sizeof(float));
+      m_pending_len += n;
+      in += n * 2;
+      in_samples -= n;
+      if( m_pending_len < m_length ) {
+         continue;
+      }
+
+      // share the frames out, the caller taking the first share
+      size_t frames = (m_pending_len - m_length) / m_hop + 1;
+      m_batch.resize(std::max(m_batch.size(), frames * outputs * 2));
+      m_batch_frames = frames;
+      if( m_shares > 1 ) {
+         {
+            std::lock_guard<std::mutex> lock(m_lock);
+            ++m_generation;
+            m_finished = 0;
+         }
+         m_start.notify_all();
+      }
+      run_frames(0, frames / m_shares, m_scratch);
+      if( m_shares > 1 ) {
+         std::unique_lock<std::mutex> lock(m_lock);
+         while( m_finished + 1 < m_shares ) {
+            m_done.wait(lock);
+         }
+      }
+
+      // mix each output down by what is left of its offset
+      for( size_t c = 0; c < outputs; ++c ) {
+         output_info& out = m_outputs[c];
+         out.data.resize(std::max(out.data.size(), (produced + frames) * 2));
+         float* dst = &out.data[produced * 2];
+         std::complex<double> rot = std::polar(1.0, out.phase);
+         const std::complex<double> step = std::polar(1.0, out.step);
+         for( size_t f = 0; f < frames; ++f ) {
+            std::complex<float> v(m_batch[(f * outputs + c) * 2], m_batch[(f * outputs + c) * 2 + 1]);
+            v *= std::complex<float>(rot);
+            dst[f * 2] = v.real();
+            dst[f * 2 + 1] = v.imag();
+            rot *= step;
+         }
+         out.phase = std::fmod(out.phase + frames * out.step, 2 * M_PI);
+      }
+      produced += frames;
+      m_frame += frames;
+
+      size_t used = frames * m_hop;
+      memmove(m_pending.data(), &m_pending[used * 2], (m_pending_len - used) * 2 * sizeof(float));
+      m_pending_len -= used;
+   }
+   return produced;
+}
+
+// Frames first to first + count - 1 of the current batch into m_batch
+void pfb_channelizer::run_frames(size_t first, size_t count, std::vector<float>& scratch)
+{
+   const size_t outputs = m_outputs.size();
+   for( size_t f = first; f < first + count; ++f ) {
+      presum(&m_pending[f * m_hop * 2], m_prototype.data(), scratch.data(),
+             m_channels * 2, m_channels * 2, TapsPerBranch);
+      m_fft.forward(scratch.data());
+      // frames start M / 2 samples apart, so against a fixed time origin
+      // channel k turns by pi * k per frame
+      const bool odd = (m_frame + f) & 1;
+      for( size_t c = 0; c < outputs; ++c ) {
+         uint32_t k = m_outputs[c].channel;
+         float sign = odd && (k & 1) ? -1.0f : 1.0f;
+         m_batch[(f * outputs + c) * 2] = sign * scratch[k * 2];
+         m_batch[(f * outputs + c) * 2 + 1] = sign * scratch[k * 2 + 1];
+      }
+   }
+}
+
+void pfb_channelizer::worker_loop(unsigned index)
+{
+   std::vector<float> scratch(m_channels * 2);
+   uint64_t seen = 0;
+   std::unique_lock<std::mutex> lock(m_lock);
+   while( true ) {
+      while( m_generation == seen && !m_stopping ) {
+         m_start.wait(lock);
+      }
+      if( m_stopping ) {
+         break;
+      }
+      seen = m_generation;
+      size_t frames = m_batch_frames;
+      lock.unlock();
+
+      // share index, up to the next one; the last takes any remainder
+      size_t first = frames * index / m_shares;
+      size_t end = index + 1 == m_shares ? frames : frames * (index + 1) / m_shares;
+      run_frames(first, end - first, scratch);
+
+      lock.lock();
+      ++m_finished;
+      m_done.notify_one();
+   }
+}
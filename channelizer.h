@@ -0,0 +1,104 @@
+/*
+ * Polyphase filterbank channelizer for interleaved complex float samples.
+ *
+ * The input band is split into M = channels() channels spaced
+ * input_rate / M apart, each output at twice that spacing (2x
+ * oversampled), so that any frequency in the band lies well inside the
+ * flat part of some channel rather than on an edge between two.
+ *
+ * Every M / 2 input samples one frame is computed: the newest
+ * TapsPerBranch * M samples are weighted by a Kaiser-windowed lowpass
+ * prototype, folded into M points (the polyphase sum, SSE2/AVX2) and
+ * transformed with an M-point fft_radix2. Bin k of a frame is then the
+ * next sample of channel k, mixed down to 0 Hz. Frames only depend on the
+ * input, so each batch of them is shared out over worker threads.
+ *
+ * Outputs are taken from the channels nearest the wanted frequencies and
+ * mixed by the rest of the offset, so they are centred exactly; all have
+ * unity gain in the passband, which is flat to +-0.75 channel spacings
+ * around the channel centre.
+ */
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+
+class pfb_channelizer {
+public:
+   // prototype taps per polyphase branch; about 90 dB stopband
+   static const uint32_t TapsPerBranch = 12;
+
+   // channels is M, a power of two of at least 2. threads workers share
+   // the frames with the caller; 0 does everything in process().
+   pfb_channelizer(double input_rate, uint32_t channels, unsigned threads);
+   ~pfb_channelizer();
+
+   pfb_channelizer(const pfb_channelizer&) = delete;
+   pfb_channelizer& operator=(const pfb_channelizer&) = delete;
+
+   // Add an output centred offset Hz from the centre of the input band;
+   // returns its index for output()
+   size_t add_output(double offset);
+
+   // most samples per output process() can produce from in_samples inputs
+   size_t max_output(size_t in_samples) const { return in_samples / m_hop + 1; }
+
+   // Channelize in_samples complex samples. Returns the number of new
+   // samples now in every output.
+   size_t process(const float* in, size_t in_samples);
+
+   const float* output(size_t index) const { return m_outputs[index].data.data(); }
+
+   uint32_t channels() const { return m_channels; }
+   double spacing() const { return m_input_rate / m_channels; }
+   double output_rate() const { return 2 * m_input_rate / m_channels; }
+   // channel an output is taken from, 0 being the centre
+   uint32_t output_channel(size_t index) const { return m_outputs[index].channel; }
+
+private:
+   struct output_info {
+      uint32_t channel;
+      double step;               // mixing phase step per output sample, radians
+      double phase;
+      std::vector<float> data;   // interleaved, grown as needed
+   };
+
+   void run_frames(size_t first, size_t count, std::vector<float>& scratch);
+   void worker_loop(unsigned index);
+
+   double m_input_rate;
+   uint32_t m_channels;
+   uint32_t m_hop;                // M / 2
+   uint32_t m_length;             // TapsPerBranch * M
+   fft_radix2 m_fft;
+   std::vector<float> m_prototype; // 2 * m_length, repeated for I and Q
+
+   std::vector<output_info> m_outputs;
+
+   std::vector<float> m_pending;  // input not yet used up by frames
+   size_t m_pending_len;          // in complex samples
+   uint64_t m_frame;              // frames produced so far
+
+   // the batch being shared out: bins of each frame for every output
+   size_t m_batch_frames;
+   std::vector<float> m_batch;    // frame-major, 2 floats per output
+   std::vector<float> m_scratch;  // the caller's share
+   unsigned m_shares;             // worker threads plus the caller
+
+   std::mutex m_lock;
+   std::condition_variable m_start;
+   std::condition_variable m_done;
+   uint64_t m_generation;
+   unsigned m_finished;
+   bool m_stopping;
+   std::vector<std::thread*> m_threads;
+};
+
+#endif /* CHANNELIZER_H */
@@ -0,0 +1,203 @@
+/*
+ * In-place radix-2 FFT for interleaved complex float data.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "fft.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_X86 1
+#endif
+
+namespace {
+
+// One butterfly stage of half-width h over n complex samples: in every
+// block of 2h, a' = a + w^k b and b' = a - w^k b for the k'th pair.
+// tw_re/tw_im are this stage's twiddles in the layout fft.h describes.
+
+void butterflies_scalar(float* data, size_t n, size_t h, const float* tw_re, const float* tw_im)
+{
+   for( size_t j = 0; j < n; j += 2 * h ) {
+      float* a = data + j * 2;
+      float* b = a + h * 2;
+      for( size_t k = 0; k < h * 2; k += 2 ) {
+         float t_re = b[k] * tw_re[k] + b[k + 1] * tw_im[k];
+         float t_im = b[k + 1] * tw_re[k + 1] + b[k] * tw_im[k + 1];
+         b[k] = a[k] - t_re;
+         b[k + 1] = a[k + 1] - t_im;
+         a[k] += t_re;
+         a[k + 1] += t_im;
+      }
+   }
+}
+
+// The first two stages (h = 1 and 2, twiddles 1 and -i) together, as one
+// radix-4 pass; too narrow to vectorise separately, so merging them saves
+// a trip over the data
+void first_stages(float* data, size_t n)
+{
+   if( n < 4 ) {
+      float r = data[0] - data[2];
+      float i = data[1] - data[3];
+      data[0] += data[2];
+      data[1] += data[3];
+      data[2] = r;
+      data[3] = i;
+      return;
+   }
+   for( size_t j = 0; j < n * 2; j += 8 ) {
+      float* x = data + j;
+      float a0r = x[0] + x[2], a0i = x[1] + x[3];
+      float a1r = x[0] - x[2], a1i = x[1] - x[3];
+      float a2r = x[4] + x[6], a2i = x[5] + x[7];
+      float a3r = x[4] - x[6], a3i = x[5] - x[7];
+      // -i * a3 = (a3i, -a3r)
+      x[0] = a0r + a2r;
+      x[1] = a0i + a2i;
+      x[4] = a0r - a2r;
+      x[5] = a0i - a2i;
+      x[2] = a1r + a3i;
+      x[3] = a1i - a3r;
+      x[6] = a1r - a3i;
+      x[7] = a1i + a3r;
+   }
+}
+
+#ifdef FFT_X86
+
+__attribute__((target("sse2")))
+void butterflies_sse2(float* data, size_t n, size_t h, const float* tw_re, const float* tw_im)
+{
+   if( h < 2 ) {
+      butterflies_scalar(data, n, h, tw_re, tw_im);
+      return;
+   }
+   for( size_t j = 0; j < n; j += 2 * h ) {
+      float* a = data + j * 2;
+      float* b = a + h * 2;
+      for( size_t k = 0; k < h * 2; k += 4 ) {
+         __m128 bv = _mm_loadu_ps(b + k);
+         __m128 swapped = _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(2, 3, 0, 1));
+         __m128 t = _mm_add_ps(_mm_mul_ps(bv, _mm_loadu_ps(tw_re + k)),
+                               _mm_mul_ps(swapped, _mm_loadu_ps(tw_im + k)));
+         __m128 av = _mm_loadu_ps(a + k);
+         _mm_storeu_ps(b + k, _mm_sub_ps(av, t));
+         _mm_storeu_ps(a + k, _mm_add_ps(av, t));
+      }
+   }
+}
+
+__attribute__((target("avx2")))
+void butterflies_avx2(float* data, size_t n, size_t h, const float* tw_re, const float* tw_im)
+{
+   if( h < 4 ) {
+      butterflies_sse2(data, n, h, tw_re, tw_im);
+      return;
+   }
+   for( size_t j = 0; j < n; j += 2 * h ) {
+      float* a = data + j * 2;
+      float* b = a + h * 2;
+      for( size_t k = 0; k < h * 2; k += 8 ) {
+         __m256 bv = _mm256_loadu_ps(b + k);
+         __m256 swapped = _mm256_permute_ps(bv, _MM_SHUFFLE(2, 3, 0, 1));
+         __m256 t = _mm256_add_ps(_mm256_mul_ps(bv, _mm256_loadu_ps(tw_re + k)),
+                                  _mm256_mul_ps(swapped, _mm256_loadu_ps(tw_im + k)));
+         __m256 av = _mm256_loadu_ps(a + k);
+         _mm256_storeu_ps(b + k, _mm256_sub_ps(av, t));
+         _mm256_storeu_ps(a + k, _mm256_add_ps(av, t));
+      }
+   }
+}
+
+#define BUTTERFLY_VARIANTS butterflies_avx2, butterflies_sse2, butterflies_scalar
+
+#else
+
+#define BUTTERFLY_VARIANTS NULL, NULL, butterflies_scalar
+
+#endif
+
+typedef void (*butterflies_fn)(float*, size_t, size_t, const float*, const float*);
+
+butterflies_fn select_butterflies(butterflies_fn avx2, butterflies_fn sse2, butterflies_fn scalar)
+{
+#ifdef FFT_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+void butterflies(float* data, size_t n, size_t h, const float* tw_re, const float* tw_im)
+{
+   static const butterflies_fn impl = select_butterflies(BUTTERFLY_VARIANTS);
+   impl(data, n, h, tw_re, tw_im);
+}
+
+} // namespace
+
+const uint32_t fft_radix2::MaxSize;
+
+fft_radix2::fft_radix2(uint32_t size) :
+   m_size(size)
+{
+   if( size < 2 || size > MaxSize || (size & (size - 1)) != 0 ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "FFT size must be a power of two from 2 to " +
+                                std::to_string(MaxSize) + ", not " + std::to_string(size) );
+   }
+
+   uint32_t bits = 0;
+   while( (1u << bits) < size ) {
+      ++bits;
+   }
+   for( uint32_t i = 0; i < size; ++i ) {
+      uint32_t r = 0;
+      for( uint32_t b = 0; b < bits; ++b ) {
+         r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      if( i < r ) {
+         m_swaps.push_back(std::make_pair(i, r));
+      }
+   }
+
+   // stages h = 1 .. size / 2 need 1 + 2 + ... + size / 2 = size - 1 twiddles
+   m_tw_re.resize((size - 1) * 2);
+   m_tw_im.resize((size - 1) * 2);
+   for( uint32_t h = 1; h < size; h <<= 1 ) {
+      float* re = &m_tw_re[(h - 1) * 2];
+      float* im = &m_tw_im[(h - 1) * 2];
+      for( uint32_t k = 0; k < h; ++k ) {
+         double angle = -M_PI * k / h;
+         re[k * 2] = re[k * 2 + 1] = (float)std::cos(angle);
+         im[k * 2] = (float)-std::sin(angle);
+         im[k * 2 + 1] = (float)std::sin(angle);
+      }
+   }
+}
+
+void fft_radix2::forward(float* data) const
+{
+   for( const std::pair<uint32_t, uint32_t>& s : m_swaps ) {
+      std::swap(data[s.first * 2], data[s.second * 2]);
+      std::swap(data[s.first * 2 + 1], data[s.second * 2 + 1]);
+   }
+   first_stages(data, m_size);
+   for( uint32_t h = 4; h < m_size; h <<= 1 ) {
+      butterflies(data, m_size, h, &m_tw_re[(h - 1) * 2], &m_tw_im[(h - 1) * 2]);
+   }
+}
@@ -0,0 +1,49 @@
+/*
+ * In-place radix-2 FFT for interleaved complex float data.
+ *
+ * A plan is built once per size: the bit-reversal swaps and, for every
+ * butterfly stage, its twiddle factors laid out so each stage reads them
+ * sequentially. forward() is then one permutation pass and log2(size)
+ * butterfly passes over the data, with SSE2 or AVX2 butterflies picked
+ * at run time like the kernels in sample_convert.
+ *
+ * A plan is read-only after construction, so any number of threads can
+ * run transforms with the same plan at once.
+ */
+#ifndef FFT_H
+#define FFT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class fft_radix2 {
+public:
+   // largest transform a plan can be built for
+   static const uint32_t MaxSize = 1 << 24;
+
+   // size must be a power of two from 2 to MaxSize
+   explicit fft_radix2(uint32_t size);
+
+   // Forward transform of size complex samples in data, in place. Output
+   // is in natural order (bin 0 is DC) and unscaled.
+   void forward(float* data) const;
+
+   uint32_t size() const { return m_size; }
+
+private:
+   uint32_t m_size;
+
+   // index pairs to swap for the bit-reversed input order
+   std::vector<std::pair<uint32_t, uint32_t> > m_swaps;
+
+   // Per stage, for half-width h = 1, 2, 4, ...: h twiddles w^k =
+   // exp(-2 pi i k / 2h), stored twice over as (re, re) in m_tw_re and
+   // (-im, im) in m_tw_im, so a complex multiply is two real multiplies,
+   // a swap and an add. Stage h starts at offset 2 * (h - 1).
+   std::vector<float> m_tw_re;
+   std::vector<float> m_tw_im;
+};
+
+#endif /* FFT_H */
@@ -0,0 +1,280 @@
+/*
+ * FFT frame integration kernels.
+ */
+
+#include "fft_accumulate.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_ACCUMULATE_X86 1
+#endif
+
+namespace {
+
+void accumulate_uint8_scalar(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   for( size_t i = 0; i < bins; ++i ) {
+      sums[i] += in[i];
+   }
+}
+
+void accumulate_dint4_scalar(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 2 <= bins; i += 2 ) {
+      uint8_t b = *in++;
+      sums[i] += (b & 0x0f) * 17;
+      sums[i + 1] += (b >> 4) * 17;
+   }
+   if( i < bins ) {
+      sums[i] += (*in & 0x0f) * 17;
+   }
+}
+
+void accumulate_power_uint8_scalar(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   for( size_t i = 0; i < bins; ++i ) {
+      sums[i] += lut[in[i]];
+   }
+}
+
+void accumulate_power_dint4_scalar(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 2 <= bins; i += 2 ) {
+      uint8_t b = *in++;
+      sums[i] += lut[(b & 0x0f) * 17];
+      sums[i + 1] += lut[(b >> 4) * 17];
+   }
+   if( i < bins ) {
+      sums[i] += lut[(*in & 0x0f) * 17];
+   }
+}
+
+void accumulate_power_complex_scalar(const float* in, float* sums, size_t bins)
+{
+   for( size_t i = 0; i < bins; ++i ) {
+      sums[i] += in[i * 2] * in[i * 2] + in[i * 2 + 1] * in[i * 2 + 1];
+   }
+}
+
+#ifdef FFT_ACCUMULATE_X86
+
+// Split 16 packed bytes into 32 bins scaled to 0..255, in bin order.
+// x * 17 == x | (x << 4) for a nibble, so the scaling is a shift and or.
+__attribute__((target("sse2")))
+inline void expand_dint4_sse2(__m128i v, __m128i& first, __m128i& second)
+{
+   const __m128i low_mask = _mm_set1_epi8(0x0f);
+   __m128i lo = _mm_and_si128(v, low_mask);
+   __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_mask);
+   lo = _mm_or_si128(lo, _mm_slli_epi16(lo, 4));
+   hi = _mm_or_si128(hi, _mm_slli_epi16(hi, 4));
+   first = _mm_unpacklo_epi8(lo, hi);
+   second = _mm_unpackhi_epi8(lo, hi);
+}
+
+__attribute__((target("sse2")))
+inline void add_u8x16_sse2(__m128i v, uint32_t* sums)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i w0 = _mm_unpacklo_epi8(v, zero);
+   __m128i w1 = _mm_unpackhi_epi8(v, zero);
+   __m128i* s = (__m128i*)sums;
+   _mm_storeu_si128(s + 0, _mm_add_epi32(_mm_loadu_si128(s + 0), _mm_unpacklo_epi16(w0, zero)));
+   _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(w0, zero)));
+   _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(w1, zero)));
+   _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(w1, zero)));
+}
+
+__attribute__((target("sse2")))
+void accumulate_uint8_sse2(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 16 <= bins; i += 16 ) {
+      add_u8x16_sse2(_mm_loadu_si128((const __m128i*)(in + i)), sums + i);
+   }
+   accumulate_uint8_scalar(in + i, sums + i, bins - i);
+}
+
+__attribute__((target("sse2")))
+void accumulate_dint4_sse2(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 32 <= bins; i += 32 ) {
+      __m128i first, second;
+      expand_dint4_sse2(_mm_loadu_si128((const __m128i*)(in + i / 2)), first, second);
+      add_u8x16_sse2(first, sums + i);
+      add_u8x16_sse2(second, sums + i + 16);
+   }
+   accumulate_dint4_scalar(in + i / 2, sums + i, bins - i);
+}
+
+__attribute__((target("avx2")))
+inline void add_u8x8_avx2(__m128i v, uint32_t* sums)
+{
+   __m256i* s = (__m256i*)sums;
+   _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), _mm256_cvtepu8_epi32(v)));
+}
+
+__attribute__((target("avx2")))
+void accumulate_uint8_avx2(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 32 <= bins; i += 32 ) {
+      for( size_t j = 0; j < 32; j += 8 ) {
+         add_u8x8_avx2(_mm_loadl_epi64((const __m128i*)(in + i + j)), sums + i + j);
+      }
+   }
+   accumulate_uint8_scalar(in + i, sums + i, bins - i);
+}
+
+__attribute__((target("avx2")))
+void accumulate_dint4_avx2(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 32 <= bins; i += 32 ) {
+      __m128i first, second;
+      expand_dint4_sse2(_mm_loadu_si128((const __m128i*)(in + i / 2)), first, second);
+      add_u8x8_avx2(first, sums + i);
+      add_u8x8_avx2(_mm_srli_si128(first, 8), sums + i + 8);
+      add_u8x8_avx2(second, sums + i + 16);
+      add_u8x8_avx2(_mm_srli_si128(second, 8), sums + i + 24);
+   }
+   accumulate_dint4_scalar(in + i / 2, sums + i, bins - i);
+}
+
+__attribute__((target("avx2")))
+inline void add_power_u8x8_avx2(__m128i v, const float* lut, float* sums)
+{
+   __m256 p = _mm256_i32gather_ps(lut, _mm256_cvtepu8_epi32(v), 4);
+   _mm256_storeu_ps(sums, _mm256_add_ps(_mm256_loadu_ps(sums), p));
+}
+
+__attribute__((target("avx2")))
+void accumulate_power_uint8_avx2(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 8 <= bins; i += 8 ) {
+      add_power_u8x8_avx2(_mm_loadl_epi64((const __m128i*)(in + i)), lut, sums + i);
+   }
+   accumulate_power_uint8_scalar(in + i, lut, sums + i, bins - i);
+}
+
+__attribute__((target("avx2")))
+void accumulate_power_dint4_avx2(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 32 <= bins; i += 32 ) {
+      __m128i first, second;
+      expand_dint4_sse2(_mm_loadu_si128((const __m128i*)(in + i / 2)), first, second);
+      add_power_u8x8_avx2(first, lut, sums + i);
+      add_power_u8x8_avx2(_mm_srli_si128(first, 8), lut, sums + i + 8);
+      add_power_u8x8_avx2(second, lut, sums + i + 16);
+      add_power_u8x8_avx2(_mm_srli_si128(second, 8), lut, sums + i + 24);
+   }
+   accumulate_power_dint4_scalar(in + i / 2, lut, sums + i, bins - i);
+}
+
+__attribute__((target("sse2")))
+void accumulate_power_complex_sse2(const float* in, float* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 4 <= bins; i += 4 ) {
+      __m128 a = _mm_loadu_ps(in + i * 2);
+      __m128 b = _mm_loadu_ps(in + i * 2 + 4);
+      a = _mm_mul_ps(a, a);
+      b = _mm_mul_ps(b, b);
+      // even lanes are re^2, odd lanes im^2
+      __m128 p = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                            _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+      _mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), p));
+   }
+   accumulate_power_complex_scalar(in + i * 2, sums + i, bins - i);
+}
+
+__attribute__((target("avx2")))
+void accumulate_power_complex_avx2(const float* in, float* sums, size_t bins)
+{
+   size_t i = 0;
+   for( ; i + 8 <= bins; i += 8 ) {
+      __m256 a = _mm256_loadu_ps(in + i * 2);
+      __m256 b = _mm256_loadu_ps(in + i * 2 + 8);
+      // hadd works per 128-bit lane: bins 0 1 4 5 | 2 3 6 7
+      __m256 p = _mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+      p = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(p), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm256_storeu_ps(sums + i, _mm256_add_ps(_mm256_loadu_ps(sums + i), p));
+   }
+   accumulate_power_complex_sse2(in + i * 2, sums + i, bins - i);
+}
+
+#define ACCUMULATE_VARIANTS(name) name##_avx2, name##_sse2, name##_scalar
+// table lookups gain nothing from SSE2, only from AVX2's gather
+#define POWER_VARIANTS(name) name##_avx2, name##_scalar, name##_scalar
+
+#else
+
+#define ACCUMULATE_VARIANTS(name) NULL, NULL, name##_scalar
+#define POWER_VARIANTS(name) NULL, NULL, name##_scalar
+
+#endif
+
+typedef void (*accumulate_fn)(const uint8_t*, uint32_t*, size_t);
+typedef void (*accumulate_power_fn)(const uint8_t*, const float*, float*, size_t);
+typedef void (*accumulate_complex_fn)(const float*, float*, size_t);
+
+template <class Fn>
+Fn select_variant(Fn avx2, Fn sse2, Fn scalar)
+{
+#ifdef FFT_ACCUMULATE_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+} // namespace
+
+void accumulate_uint8(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   static const accumulate_fn impl = select_variant<accumulate_fn>(
+      ACCUMULATE_VARIANTS(accumulate_uint8));
+   impl(in, sums, bins);
+}
+
+void accumulate_dint4(const uint8_t* in, uint32_t* sums, size_t bins)
+{
+   static const accumulate_fn impl = select_variant<accumulate_fn>(
+      ACCUMULATE_VARIANTS(accumulate_dint4));
+   impl(in, sums, bins);
+}
+
+void accumulate_power_uint8(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   static const accumulate_power_fn impl = select_variant<accumulate_power_fn>(
+      POWER_VARIANTS(accumulate_power_uint8));
+   impl(in, lut, sums, bins);
+}
+
+void accumulate_power_dint4(const uint8_t* in, const float* lut, float* sums, size_t bins)
+{
+   static const accumulate_power_fn impl = select_variant<accumulate_power_fn>(
+      POWER_VARIANTS(accumulate_power_dint4));
+   impl(in, lut, sums, bins);
+}
+
+void accumulate_power_complex(const float* in, float* sums, size_t bins)
+{
+   static const accumulate_complex_fn impl = select_variant<accumulate_complex_fn>(
+      ACCUMULATE_VARIANTS(accumulate_power_complex));
+   impl(in, sums, bins);
+}
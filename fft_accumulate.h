@@ -0,0 +1,32 @@
+/*
+ * FFT frame integration kernels.
+ *
+ * These add one frame of FFT bins into a row of running sums. As in
+ * sample_convert, x86 builds carry SIMD variants that are selected at run
+ * time, with a scalar fallback everywhere else.
+ */
+#ifndef FFT_ACCUMULATE_H
+#define FFT_ACCUMULATE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Add bins uint8 values from in into sums.
+void accumulate_uint8(const uint8_t* in, uint32_t* sums, size_t bins);
+
+// Add bins 4-bit values, packed two per byte with the low nibble first,
+// into sums. Each nibble is scaled by 17 so 0..15 spans the same 0..255
+// range as a uint8 FFT frame.
+void accumulate_dint4(const uint8_t* in, uint32_t* sums, size_t bins);
+
+// Linear power variants: each bin value v (0..255, nibbles scaled as
+// above) is looked up in a 256-entry table, normally holding the power
+// that v represents, and added into float sums.
+void accumulate_power_uint8(const uint8_t* in, const float* lut, float* sums, size_t bins);
+void accumulate_power_dint4(const uint8_t* in, const float* lut, float* sums, size_t bins);
+
+// Add the power (re^2 + im^2) of bins interleaved complex values from in
+// into sums, for spectra computed here rather than by the server.
+void accumulate_power_complex(const float* in, float* sums, size_t bins);
+
+#endif /* FFT_ACCUMULATE_H */
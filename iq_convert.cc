@@ -0,0 +1,378 @@
+/*
+ * IQ output formats and the conversion from FIFO samples to them.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "iq_convert.h"
+#include "resampler.h"
+#include "sample_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IQ_CONVERT_X86 1
+#endif
+
+const iq_format_info IqFormats[IQ_FORMAT_COUNT] = {
+   { "cu8",  "cu8",     2, 128.0f },
+   { "cs8",  "ci8",     2, 128.0f },
+   { "cs16", "ci16_le", 4, 32768.0f },
+   { "cs32", "ci32_le", 8, 2147483648.0f },
+   { "cf32", "cf32_le", 8, 1.0f },
+};
+
+bool parse_iq_format(const char* name, iq_format& format)
+{
+   for( int f = 0; f < IQ_FORMAT_COUNT; ++f ) {
+      if( 0 == strcmp(IqFormats[f].name, name) ) {
+         format = (iq_format)f;
+         return true;
+      }
+   }
+   return false;
+}
+
+// complex samples per pass; keeps the float staging within L2
+static const size_t ChunkSamples = 4096;
+
+namespace {
+
+// All kernels take count values, i.e. twice the number of complex
+// samples, alternating I and Q.
+
+inline float centred(uint8_t v) { return (float)((int)v - 128); }
+inline float centred(int16_t v) { return (float)v; }
+inline float centred(int32_t v) { return (float)v; }
+inline float centred(float v) { return v; }
+
+// in -> float: out = centred(in) * scale - dc[I/Q]; sum[I/Q] gets the
+// total of centred(in) * scale, for the next DC estimate
+template <class T>
+void to_float_scalar(const T* in, float* out, size_t count, float scale, const float* dc, float* sum)
+{
+   float i_sum = 0;
+   float q_sum = 0;
+   for( size_t k = 0; k < count; k += 2 ) {
+      float i_val = centred(in[k]) * scale;
+      float q_val = centred(in[k + 1]) * scale;
+      i_sum += i_val;
+      q_sum += q_val;
+      out[k] = i_val - dc[0];
+      out[k + 1] = q_val - dc[1];
+   }
+   sum[0] += i_sum;
+   sum[1] += q_sum;
+}
+
+#ifdef IQ_CONVERT_X86
+
+// centred loads of 4 (SSE2) or 8 (AVX2) values as float
+
+__attribute__((target("sse2")))
+inline __m128 load4_sse2(const uint8_t* p)
+{
+   int32_t bytes;
+   memcpy(&bytes, p, sizeof(bytes));
+   const __m128i zero = _mm_setzero_si128();
+   __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+   return _mm_sub_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(128.0f));
+}
+
+__attribute__((target("sse2")))
+inline __m128 load4_sse2(const int16_t* p)
+{
+   __m128i v = _mm_loadl_epi64((const __m128i*)p);
+   return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+__attribute__((target("sse2")))
+inline __m128 load4_sse2(const int32_t* p)
+{
+   return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target("sse2")))
+inline __m128 load4_sse2(const float* p)
+{
+   return _mm_loadu_ps(p);
+}
+
+__attribute__((target("avx2")))
+inline __m256 load8_avx2(const uint8_t* p)
+{
+   __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+   return _mm256_sub_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(128.0f));
+}
+
+__attribute__((target("avx2")))
+inline __m256 load8_avx2(const int16_t* p)
+{
+   return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)p)));
+}
+
+__attribute__((target("avx2")))
+inline __m256 load8_avx2(const int32_t* p)
+{
+   return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p));
+}
+
+__attribute__((target("avx2")))
+inline __m256 load8_avx2(const float* p)
+{
+   return _mm256_loadu_ps(p);
+}
+
+template <class T>
+__attribute__((target("sse2")))
+void to_float_sse2(const T* in, float* out, size_t count, float scale, const float* dc, float* sum)
+{
+   const __m128 vscale = _mm_set1_ps(scale);
+   const __m128 vdc = _mm_setr_ps(dc[0], dc[1], dc[0], dc[1]);
+   __m128 acc = _mm_setzero_ps();
+   size_t k = 0;
+   for( ; k + 4 <= count; k += 4 ) {
+      __m128 v = _mm_mul_ps(load4_sse2(in + k), vscale);
+      acc = _mm_add_ps(acc, v);
+      _mm_storeu_ps(out + k, _mm_sub_ps(v, vdc));
+   }
+   // lanes are I, Q, I, Q
+   float lanes[4];
+   _mm_storeu_ps(lanes, acc);
+   sum[0] += lanes[0] + lanes[2];
+   sum[1] += lanes[1] + lanes[3];
+   to_float_scalar(in + k, out + k, count - k, scale, dc, sum);
+}
+
+template <class T>
+__attribute__((target("avx2")))
+void to_float_avx2(const T* in, float* out, size_t count, float scale, const float* dc, float* sum)
+{
+   const __m256 vscale = _mm256_set1_ps(scale);
+   const __m256 vdc = _mm256_setr_ps(dc[0], dc[1], dc[0], dc[1], dc[0], dc[1], dc[0], dc[1]);
+   __m256 acc0 = _mm256_setzero_ps();
+   __m256 acc1 = _mm256_setzero_ps();
+   size_t k = 0;
+   for( ; k + 16 <= count; k += 16 ) {
+      __m256 a = _mm256_mul_ps(load8_avx2(in + k), vscale);
+      __m256 b = _mm256_mul_ps(load8_avx2(in + k + 8), vscale);
+      acc0 = _mm256_add_ps(acc0, a);
+      acc1 = _mm256_add_ps(acc1, b);
+      _mm256_storeu_ps(out + k, _mm256_sub_ps(a, vdc));
+      _mm256_storeu_ps(out + k + 8, _mm256_sub_ps(b, vdc));
+   }
+   float lanes[8];
+   _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+   sum[0] += lanes[0] + lanes[2] + lanes[4] + lanes[6];
+   sum[1] += lanes[1] + lanes[3] + lanes[5] + lanes[7];
+   to_float_sse2(in + k, out + k, count - k, scale, dc, sum);
+}
+
+#define TO_FLOAT_VARIANTS(T) to_float_avx2<T>, to_float_sse2<T>, to_float_scalar<T>
+
+#else
+
+#define TO_FLOAT_VARIANTS(T) NULL, NULL, to_float_scalar<T>
+
+#endif
+
+template <class Fn>
+Fn select_variant(Fn avx2, Fn sse2, Fn scalar)
+{
+#ifdef IQ_CONVERT_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+template <class T>
+void iq_to_float(const T* in, float* out, size_t count, float scale, const float* dc, float* sum)
+{
+   typedef void (*to_float_fn)(const T*, float*, size_t, float, const float*, float*);
+   static const to_float_fn impl = select_variant<to_float_fn>(
+      TO_FLOAT_VARIANTS(T));
+   impl(in, out, count, scale, dc, sum);
+}
+
+// cu8 <-> cs8 is just the sign bit; simple enough for the compiler to
+// vectorise
+void flip_8bit(const uint8_t* in, uint8_t* out, size_t count)
+{
+   for( size_t k = 0; k < count; ++k ) {
+      out[k] = in[k] ^ 0x80;
+   }
+}
+
+} // namespace
+
+iq_converter::iq_converter(iq_format in, iq_format out, poly_resampler* resampler, size_t max_samples) :
+   m_in_format(in),
+   m_out_format(out),
+   m_resampler(resampler),
+   m_dither(false),
+   m_dc_time_constant(0),
+   m_dc_primed(false)
+{
+   if( in == IQ_CS8 ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " + "cs8 is an output format only" );
+   }
+   m_dc[0] = m_dc[1] = 0;
+   m_sum[0] = m_sum[1] = 0;
+   for( int k = 0; k < 8; ++k ) {
+      m_rng[k] = 0x9e3779b9u * (k + 1);
+   }
+
+   size_t max_out = resampler != NULL ? resampler->max_output(max_samples) : max_samples;
+   m_out.resize(max_out * IqFormats[out].sample_bytes);
+   m_float.resize(ChunkSamples * 2);
+   if( resampler != NULL ) {
+      m_resampled.resize(resampler->max_output(ChunkSamples) * 2);
+   }
+}
+
+void iq_converter::set_dc_removal(double time_constant)
+{
+   m_dc_time_constant = time_constant;
+   m_dc_primed = false;
+   m_dc[0] = m_dc[1] = 0;
+}
+
+bool iq_converter::passthrough() const
+{
+   return m_in_format == m_out_format && m_resampler == NULL && m_dc_time_constant == 0;
+}
+
+size_t iq_converter::convert(const void* in, size_t samples)
+{
+   const uint8_t* src = (const uint8_t*)in;
+   uint8_t* dst = (uint8_t*)m_out.data();
+   const uint32_t in_bytes = IqFormats[m_in_format].sample_bytes;
+   const uint32_t out_bytes = IqFormats[m_out_format].sample_bytes;
+   size_t produced = 0;
+   while( samples > 0 ) {
+      size_t n = std::min(samples, ChunkSamples);
+      produced += convert_chunk(src, n, dst + produced * out_bytes);
+      src += n * in_bytes;
+      samples -= n;
+   }
+   return produced;
+}
+
+size_t iq_converter::convert_chunk(const uint8_t* in, size_t samples, uint8_t* out)
+{
+   const bool to_8bit = m_out_format == IQ_CU8 || m_out_format == IQ_CS8;
+
+   // integer-only cases
+   if( m_resampler == NULL && m_dc_time_constant == 0 ) {
+      if( m_in_format == m_out_format ) {
+         memcpy(out, in, samples * IqFormats[m_in_format].sample_bytes);
+         return samples;
+      }
+      if( m_in_format == IQ_CS16 && to_8bit ) {
+         if( m_out_format == IQ_CU8 ) {
+            int16_to_uint8((const int16_t*)in, out, samples * 2, m_dither ? m_rng : NULL);
+         } else {
+            int16_to_int8((const int16_t*)in, (int8_t*)out, samples * 2, m_dither ? m_rng : NULL);
+         }
+         return samples;
+      }
+      if( m_in_format == IQ_CU8 && m_out_format == IQ_CS8 ) {
+         flip_8bit(in, out, samples * 2);
+         return samples;
+      }
+   }
+
+   // cf32 output needs no last pass, so the final float stage writes
+   // straight into the output
+   const bool float_out = m_out_format == IQ_CF32;
+   float* f = float_out && m_resampler == NULL ? (float*)out : m_float.data();
+   to_float(in, samples, f);
+   update_dc(samples);
+
+   size_t produced = samples;
+   if( m_resampler != NULL ) {
+      float* r = float_out ? (float*)out : m_resampled.data();
+      produced = m_resampler->process(f, samples, r);
+      f = r;
+   }
+   if( !float_out ) {
+      from_float(f, produced, out);
+   }
+   return produced;
+}
+
+void iq_converter::to_float(const uint8_t* in, size_t samples, float* out)
+{
+   const float scale = IqFormats[m_out_format].full_scale / IqFormats[m_in_format].full_scale;
+   m_sum[0] = m_sum[1] = 0;
+   switch( m_in_format ) {
+   case IQ_CU8:
+      if( m_dc_time_constant == 0 ) {
+         // nothing reads the sums without DC removal
+         uint8_to_float((const uint8_t*)in, out, samples * 2, scale);
+      } else {
+         iq_to_float((const uint8_t*)in, out, samples * 2, scale, m_dc, m_sum);
+      }
+      break;
+   case IQ_CS16:
+      iq_to_float((const int16_t*)in, out, samples * 2, scale, m_dc, m_sum);
+      break;
+   case IQ_CS32:
+      iq_to_float((const int32_t*)in, out, samples * 2, scale, m_dc, m_sum);
+      break;
+   default:
+      iq_to_float((const float*)in, out, samples * 2, scale, m_dc, m_sum);
+      break;
+   }
+}
+
+void iq_converter::from_float(const float* in, size_t samples, uint8_t* out)
+{
+   switch( m_out_format ) {
+   case IQ_CU8:
+      float_to_uint8(in, out, samples * 2, m_dither ? m_rng : NULL);
+      break;
+   case IQ_CS8:
+      float_to_int8(in, (int8_t*)out, samples * 2, m_dither ? m_rng : NULL);
+      break;
+   case IQ_CS16:
+      float_to_int16(in, (int16_t*)out, samples * 2);
+      break;
+   case IQ_CS32:
+      float_to_int32(in, (int32_t*)out, samples * 2);
+      break;
+   default:
+      break;
+   }
+}
+
+void iq_converter::update_dc(size_t samples)
+{
+   if( m_dc_time_constant == 0 || samples == 0 ) {
+      return;
+   }
+   for( int c = 0; c < 2; ++c ) {
+      float mean = m_sum[c] / samples;
+      if( !m_dc_primed ) {
+         // start from the first chunk's mean rather than settling from 0
+         m_dc[c] = mean;
+      } else {
+         float alpha = (float)std::min(1.0, samples / m_dc_time_constant);
+         m_dc[c] += alpha * (mean - m_dc[c]);
+      }
+   }
+   m_dc_primed = true;
+}
@@ -0,0 +1,91 @@
+/*
+ * IQ output formats and the conversion from FIFO samples to them.
+ *
+ * iq_converter turns a batch of samples in the FIFO's format into the
+ * requested output format, optionally removing DC, resampling and
+ * dithering on the way. Work is done in cache-sized chunks and each step
+ * is a single fused pass:
+ *
+ *   in -> float:   centre, scale to the output format's full scale,
+ *                  subtract the running DC estimate and sum for the next
+ *                  one
+ *   resample:      poly_resampler, in float
+ *   float -> out:  add TPDF dither (8-bit outputs), round, saturate, pack
+ *
+ * When none of that is needed the common narrowing cases skip float
+ * entirely: cs16 -> cs8/cu8 (with or without dither) and cu8 <-> cs8 are
+ * single integer passes. Same format in and out is a passthrough and the
+ * caller writes straight from the FIFO.
+ *
+ * The element-wise conversions (8-bit in and out, with dither, and the
+ * cs16 narrowing) are sample_convert's; the fused DC pass to float is
+ * here. All have SSE2 and AVX2 versions picked at run time.
+ */
+#ifndef IQ_CONVERT_H
+#define IQ_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class poly_resampler;
+
+enum iq_format { IQ_CU8, IQ_CS8, IQ_CS16, IQ_CS32, IQ_CF32, IQ_FORMAT_COUNT };
+
+struct iq_format_info {
+   const char* name;
+   const char* sigmf_datatype;
+   uint32_t sample_bytes;     // per complex sample
+   float full_scale;          // float value of integer full scale
+};
+
+extern const iq_format_info IqFormats[IQ_FORMAT_COUNT];
+
+// false if name is not one of the IqFormats names
+bool parse_iq_format(const char* name, iq_format& format);
+
+class iq_converter {
+public:
+   // Converts batches of up to max_samples. The resampler, if any, is
+   // not owned and must outlive the converter.
+   iq_converter(iq_format in, iq_format out, poly_resampler* resampler, size_t max_samples);
+
+   // Subtract a running mean from I and Q, following it with the given
+   // time constant in input samples; 0 turns it off.
+   void set_dc_removal(double time_constant);
+
+   // TPDF dither of +-1 LSB when narrowing to cs8 or cu8
+   void set_dither(bool enable) { m_dither = enable; }
+
+   // true when input and output are identical and can be written as is
+   bool passthrough() const;
+
+   // Convert samples from in (in the input format) into output(); returns
+   // the number of output samples
+   size_t convert(const void* in, size_t samples);
+
+   const char* output() const { return m_out.data(); }
+   uint32_t output_sample_bytes() const { return IqFormats[m_out_format].sample_bytes; }
+
+private:
+   size_t convert_chunk(const uint8_t* in, size_t samples, uint8_t* out);
+   void to_float(const uint8_t* in, size_t samples, float* out);
+   void from_float(const float* in, size_t samples, uint8_t* out);
+   void update_dc(size_t samples);
+
+   iq_format m_in_format;
+   iq_format m_out_format;
+   poly_resampler* m_resampler;
+   bool m_dither;
+   double m_dc_time_constant;
+   bool m_dc_primed;
+   float m_dc[2];          // current estimate, output scale
+   float m_sum[2];         // of the chunk just converted, before correction
+   uint32_t m_rng[8];      // xorshift32 lanes for the dither
+
+   std::vector<char> m_out;
+   std::vector<float> m_float;      // chunk as float
+   std::vector<float> m_resampled;  // chunk after the resampler
+};
+
+#endif /* IQ_CONVERT_H */
@@ -0,0 +1,287 @@
+/*
+ * Power spectra computed here from the IQ stream.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "iq_spectrum.h"
+#include "fft_accumulate.h"
+
+namespace {
+
+// w = a0 - a1 cos(x) + a2 cos(2x) - a3 cos(3x), indexed by iq_spectrum::window
+const double Windows[][4] = {
+   { 1.0, 0.0, 0.0, 0.0 },
+   { 0.5, 0.5, 0.0, 0.0 },
+   { 0.54, 0.46, 0.0, 0.0 },
+   { 0.42, 0.5, 0.08, 0.0 },
+   { 0.35875, 0.48829, 0.14128, 0.01168 },
+};
+
+struct window_name {
+   const char* name;
+   iq_spectrum::window win;
+};
+
+const window_name WindowNames[] = {
+   { "rectangle",       iq_spectrum::RECTANGULAR },
+   { "rect",            iq_spectrum::RECTANGULAR },
+   { "hann",            iq_spectrum::HANN },
+   { "hamming",         iq_spectrum::HAMMING },
+   { "blackman",        iq_spectrum::BLACKMAN },
+   { "blackman-harris", iq_spectrum::BLACKMAN_HARRIS },
+};
+
+} // namespace
+
+const uint32_t iq_spectrum::BatchSamples;
+const int iq_spectrum::PowerWaitMs;
+
+bool iq_spectrum::parse_window(const char* name, window& win)
+{
+   for( const window_name& w : WindowNames ) {
+      if( 0 == strcmp(w.name, name) ) {
+         win = w.win;
+         return true;
+      }
+   }
+   return false;
+}
+
+iq_spectrum::iq_spectrum(iq_format in, uint32_t bins, window win, double overlap, unsigned threads,
+                         size_t max_samples) :
+   m_bins(bins),
+   m_hop(0),
+   m_fft(bins),
+   m_input_bytes(IqFormats[in].sample_bytes),
+   m_converter(in, IQ_CF32, NULL, bins * 2),
+   m_passthrough(in == IQ_CF32),
+   m_pending_len(0),
+   m_batch_frames(std::max<uint32_t>(1, BatchSamples / bins)),
+   m_current(NULL),
+   m_dropped(0),
+   m_count(0),
+   m_queued(0),
+   m_merged(0),
+   m_stopping(false)
+{
+   if( !(overlap >= 0 && overlap <= 0.95) ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Overlap must be from 0 to 0.95, not " + std::to_string(overlap) );
+   }
+   m_hop = std::max<uint32_t>(1, (uint32_t)std::lround(bins * (1.0 - overlap)));
+
+   // periodic (DFT-even) window, normalised so a tone's power is its
+   // amplitude squared whatever the window and size
+   const double* a = Windows[win];
+   std::vector<double> w(bins);
+   double sum = 0;
+   for( uint32_t n = 0; n < bins; ++n ) {
+      double x = 2 * M_PI * n / bins;
+      w[n] = a[0] - a[1] * std::cos(x) + a[2] * std::cos(2 * x) - a[3] * std::cos(3 * x);
+      sum += w[n];
+   }
+   m_window.resize(bins * 2);
+   for( uint32_t n = 0; n < bins; ++n ) {
+      m_window[n * 2] = m_window[n * 2 + 1] = (float)(w[n] / sum);
+   }
+
+   m_pending.resize(bins * 2 * 2);
+   m_power_sums.assign(bins, 0);
+
+   // room for every frame one process() call can produce, in whole
+   // batches plus the part-filled one carried in, and one more per worker
+   // to be transforming meanwhile; only a sustained backlog drops frames
+   size_t max_frames = max_samples / m_hop + 1;
+   m_batches.resize((max_frames + m_batch_frames - 1) / m_batch_frames + 1 + std::max(threads, 1u));
+   for( batch& b : m_batches ) {
+      b.data.resize((size_t)m_batch_frames * bins * 2);
+      b.frames = 0;
+      m_free.push_back(&b);
+   }
+
+   if( threads == 0 ) {
+      m_inline_sums.assign(bins, 0);
+      m_flush_sums.assign(bins, 0);
+   }
+   for( unsigned t = 0; t < threads; ++t ) {
+      m_threads.push_back(new std::thread(&iq_spectrum::worker_loop, this));
+   }
+}
+
+iq_spectrum::~iq_spectrum()
+{
+   stop();
+   for( std::thread* t : m_threads ) {
+      t->join();
+      delete t;
+   }
+}
+
+void iq_spectrum::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stopping = true;
+   }
+   m_full_avail.notify_all();
+   m_power_avail.notify_all();
+}
+
+void iq_spectrum::process(const void* in, size_t samples)
+{
+   const uint8_t* src = (const uint8_t*)in;
+   while( samples > 0 ) {
+      // after framing fewer than bins samples are pending, so there is
+      // always room for at least bins more
+      size_t n = std::min<size_t>(samples, m_bins * 2 - m_pending_len);
+      const void* conv = src;
+      if( !m_passthrough ) {
+         m_converter.convert(src, n);
+         conv = m_converter.output();
+      }
+      memcpy(&m_pending[m_pending_len * 2], conv, n * 2 * sizeof(float));
+      m_pending_len += n;
+      src += n * m_input_bytes;
+      samples -= n;
+
+      size_t pos = 0;
+      for( ; pos + m_bins <= m_pending_len; pos += m_hop ) {
+         add_frame(&m_pending[pos * 2]);
+      }
+      memmove(m_pending.data(), &m_pending[pos * 2], (m_pending_len - pos) * 2 * sizeof(float));
+      m_pending_len -= pos;
+   }
+}
+
+void iq_spectrum::add_frame(const float* frame)
+{
+   batch* b;
+   {
+      // get_power() may take the batch before it is full
+      std::lock_guard<std::mutex> lock(m_lock);
+      if( NULL == m_current ) {
+         if( m_free.empty() ) {
+            ++m_dropped;
+            return;
+         }
+         m_current = m_free.back();
+         m_free.pop_back();
+         m_current->frames = 0;
+      }
+
+      memcpy(&m_current->data[(size_t)m_current->frames * m_bins * 2], frame, m_bins * 2 * sizeof(float));
+      if( ++m_current->frames < m_batch_frames ) {
+         return;
+      }
+      b = m_current;
+      m_current = NULL;
+      ++m_queued;
+      if( !m_threads.empty() ) {
+         m_full.push_back(b);
+      }
+   }
+
+   if( m_threads.empty() ) {
+      transform(b, m_inline_sums);
+      merge(b, m_inline_sums);
+   } else {
+      m_full_avail.notify_one();
+   }
+}
+
+void iq_spectrum::transform(batch* b, std::vector<float>& sums)
+{
+   const size_t half = m_bins / 2;
+   for( uint32_t f = 0; f < b->frames; ++f ) {
+      float* x = &b->data[(size_t)f * m_bins * 2];
+      for( size_t k = 0; k < m_bins * 2; ++k ) {
+         x[k] *= m_window[k];
+      }
+      m_fft.forward(x);
+      // negative frequencies (the top half of the FFT) come first
+      accumulate_power_complex(x + half * 2, sums.data(), half);
+      accumulate_power_complex(x, sums.data() + half, half);
+   }
+}
+
+// Fold a transformed batch's sums into the shared ones, zero them for the
+// next batch and put the batch back on the free list
+void iq_spectrum::merge(batch* b, std::vector<float>& sums)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      for( size_t i = 0; i < m_bins; ++i ) {
+         m_power_sums[i] += sums[i];
+      }
+      m_count += b->frames;
+      ++m_merged;
+      m_free.push_back(b);
+   }
+   std::fill(sums.begin(), sums.end(), 0.0f);
+   m_power_avail.notify_one();
+}
+
+void iq_spectrum::worker_loop()
+{
+   std::vector<float> sums(m_bins, 0.0f);
+   std::unique_lock<std::mutex> lock(m_lock);
+   while( true ) {
+      while( m_full.empty() && !m_stopping ) {
+         m_full_avail.wait(lock);
+      }
+      if( m_stopping ) {
+         break;
+      }
+      batch* b = m_full.front();
+      m_full.pop_front();
+      lock.unlock();
+
+      transform(b, sums);
+      merge(b, sums);
+
+      lock.lock();
+   }
+}
+
+void iq_spectrum::get_power(std::vector<float>& outdata, int& outperiods, bool flush)
+{
+   // same hand-off as ss_client_if::get_fft_power()
+   outdata.assign(m_bins, 0);
+
+   std::unique_lock<std::mutex> lock(m_lock);
+
+   if( flush ) {
+      if( NULL != m_current ) {
+         batch* b = m_current;
+         m_current = NULL;
+         ++m_queued;
+         if( m_threads.empty() ) {
+            lock.unlock();
+            transform(b, m_flush_sums);
+            merge(b, m_flush_sums);
+            lock.lock();
+         } else {
+            m_full.push_back(b);
+            m_full_avail.notify_one();
+         }
+      }
+      // including full batches still queued or with the workers
+      const uint64_t queued = m_queued;
+      while( m_merged < queued && !m_stopping ) {
+         m_power_avail.wait(lock);
+      }
+   }
+
+   m_power_avail.wait_for(lock, std::chrono::milliseconds(PowerWaitMs),
+                          [this] { return 0 != m_count || m_stopping; });
+
+   outdata.swap(m_power_sums);
+   outperiods = m_count;
+   m_count = 0;
+}
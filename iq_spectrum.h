@@ -0,0 +1,131 @@
+/*
+ * Power spectra computed here from the IQ stream.
+ *
+ * The server's FFT stream is 8-bit dB over a range it picks, with bins
+ * set by SETTING_FFT_DISPLAY_PIXELS. iq_spectrum instead takes samples
+ * from the IQ FIFO and does the whole Welch estimate in the client:
+ *
+ *   - samples are converted to cf32 (full scale 1.0) and cut into frames
+ *     of bins samples, each starting hop = bins * (1 - overlap) after the
+ *     last, so with overlap every sample lands in more than one frame
+ *   - frames are gathered into batches of about BatchSamples samples
+ *     (at least one frame) and handed to a pool of worker threads; the
+ *     caller only copies samples, so the IQ consumer is never held up by
+ *     the transforms
+ *   - each worker windows, transforms (fft_radix2) and adds |X|^2 into
+ *     its own float sums, folding them into the shared sums once per
+ *     batch
+ *
+ * get_power() hands the sums over the same way ss_client_if's
+ * get_fft_power() does, so fft_work_thread reports either one. At the
+ * end of an interval it also takes the part-filled batch, so no frame
+ * is credited to the interval after the one it belongs to. Bins are
+ * in frequency order, lowest first, and scaled so that a full-scale tone
+ * sums to 1.0 per frame, i.e. reads 0 dBFS.
+ *
+ * There are enough batch buffers for the frames of the largest process()
+ * call plus one batch per worker. If every one is still waiting on the
+ * workers when a frame is due, they are falling behind, and the frame is
+ * dropped and counted rather than stalling the caller.
+ */
+#ifndef IQ_SPECTRUM_H
+#define IQ_SPECTRUM_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+#include "iq_convert.h"
+
+class iq_spectrum {
+public:
+   enum window { RECTANGULAR, HANN, HAMMING, BLACKMAN, BLACKMAN_HARRIS };
+
+   // samples per batch handed to a worker, 1 MiB of cf32; a batch holds
+   // as many whole frames as fit, and never fewer than one
+   static const uint32_t BatchSamples = 128 * 1024;
+
+   // false if name is not rectangle (or rect), hann, hamming, blackman or
+   // blackman-harris. Other than hann, these are rtl_power's -w spellings.
+   static bool parse_window(const char* name, window& win);
+
+   // Frames of bins samples (a power of two) of input in format in,
+   // overlapping by overlap (0 to 0.95) of a frame. threads workers do
+   // the transforms; 0 does them in process() itself. max_samples is the
+   // most process() is given at once.
+   iq_spectrum(iq_format in, uint32_t bins, window win, double overlap, unsigned threads,
+               size_t max_samples);
+   ~iq_spectrum();
+
+   iq_spectrum(const iq_spectrum&) = delete;
+   iq_spectrum& operator=(const iq_spectrum&) = delete;
+
+   // Queue samples (in the input format) for analysis
+   void process(const void* in, size_t samples);
+
+   // Hands back the power sums and the number of frames in them, waiting
+   // up to PowerWaitMs for at least one; outdata's storage becomes the next
+   // accumulation buffer. With flush, as at the end of an interval, the
+   // part-filled batch goes too, and everything process() has framed so
+   // far is summed first. Returns with outperiods 0 once stopped.
+   void get_power(std::vector<float>& outdata, int& outperiods, bool flush = false);
+
+   // Wake get_power() for good; frames not yet summed are discarded
+   void stop();
+
+   uint32_t bins() const { return m_bins; }
+   uint32_t hop() const { return m_hop; }
+   uint64_t frames_dropped() const { return m_dropped; }
+
+private:
+   // short enough for the caller to notice the end of its interval
+   static const int PowerWaitMs = 100;
+
+   struct batch {
+      std::vector<float> data;   // m_batch_frames frames of bins complex samples
+      uint32_t frames;
+   };
+
+   void add_frame(const float* frame);
+   void transform(batch* b, std::vector<float>& sums);
+   void merge(batch* b, std::vector<float>& sums);
+   void worker_loop();
+
+   uint32_t m_bins;
+   uint32_t m_hop;
+   fft_radix2 m_fft;
+   std::vector<float> m_window;   // repeated for I and Q, scaled to sum to 1
+
+   uint32_t m_input_bytes;        // per complex sample
+   iq_converter m_converter;
+   bool m_passthrough;            // input is already cf32
+   std::vector<float> m_pending;  // up to 2 * bins samples not yet framed
+   size_t m_pending_len;
+
+   uint32_t m_batch_frames;
+   std::vector<batch> m_batches;
+   batch* m_current;              // being filled by process(), under m_lock
+   uint64_t m_dropped;
+   std::vector<float> m_inline_sums; // worker sums when there are no workers
+   std::vector<float> m_flush_sums;  // get_power()'s, likewise
+
+   std::mutex m_lock;
+   std::condition_variable m_full_avail;
+   std::condition_variable m_power_avail;
+   std::deque<batch*> m_full;
+   std::vector<batch*> m_free;
+   std::vector<float> m_power_sums;
+   uint32_t m_count;
+   uint64_t m_queued;             // batches ever handed off to be transformed
+   uint64_t m_merged;             // and of those, summed into m_power_sums
+   bool m_stopping;
+
+   std::vector<std::thread*> m_threads;
+};
+
+#endif /* IQ_SPECTRUM_H */
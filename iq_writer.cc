@@ -0,0 +1,435 @@
+/*
+ * Asynchronous IQ output stage.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "iq_writer.h"
+
+iq_writer::iq_writer(const std::string& filename, size_t buffer_size, size_t buffer_count,
+                     uint64_t expected_bytes, bool use_uring, bool use_vmsplice) :
+   m_filename(filename),
+   m_fd(-1),
+   m_is_file(false),
+   m_offset(0),
+   m_expected_bytes(expected_bytes),
+   m_buffer_size(0),
+   m_current(NULL),
+   m_stopping(false),
+   m_failed(false),
+   m_thread(NULL),
+   m_uring(NULL),
+   m_direct(false),
+   m_max_batch(IOV_MAX),
+   m_splice(false),
+   m_backend("writev")
+{
+   if( m_filename == "-" ) {
+      m_fd = STDOUT_FILENO;
+   } else {
+      int flags = O_WRONLY | O_CREAT | O_TRUNC;
+      if( use_uring ) {
+         // not every filesystem does direct I/O (tmpfs doesn't)
+         m_fd = open(m_filename.c_str(), flags | O_DIRECT, 0644);
+         m_direct = (m_fd >= 0);
+      }
+      if( m_fd < 0 ) {
+         m_fd = open(m_filename.c_str(), flags, 0644);
+      }
+      if( m_fd < 0 ) {
+         throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                   "Failed to open " + m_filename + ": " + strerror(errno) );
+      }
+   }
+
+   struct stat st;
+   m_is_file = (0 == fstat(m_fd, &st) && S_ISREG(st.st_mode));
+   if( use_vmsplice ) {
+      if( !m_is_file && S_ISFIFO(st.st_mode) ) {
+         m_splice = true;
+         m_backend = "vmsplice";
+      } else {
+         std::cerr << "iq_writer: vmsplice output needs a pipe; ignoring" << std::endl;
+      }
+   }
+   if( m_is_file ) {
+      m_backend = "pwritev";
+      // stdout may be a file opened elsewhere; append after what's there
+      m_offset = lseek(m_fd, 0, SEEK_CUR);
+      if( m_expected_bytes > 0 ) {
+         // best effort: not every filesystem can preallocate
+         int err = posix_fallocate(m_fd, m_offset, m_expected_bytes);
+         if( err != 0 && err != EOPNOTSUPP && err != EINVAL ) {
+            std::cerr << "iq_writer: could not preallocate " << m_expected_bytes
+                      << " bytes: " << strerror(err) << std::endl;
+         }
+      }
+   }
+
+   // page aligned, which direct I/O and vmsplice both want
+   long page = sysconf(_SC_PAGESIZE);
+   m_buffer_size = (std::max(buffer_size, (size_t)1) + page - 1) / page * page;
+   buffer_count = std::max(buffer_count, (size_t)2);
+   m_buffers.resize(buffer_count);
+   for( buffer& b : m_buffers ) {
+      void* mem = NULL;
+      if( 0 != posix_memalign(&mem, page, m_buffer_size) ) {
+         throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                   "Failed to allocate writer buffers" );
+      }
+      b.data = (char*)mem;
+      b.len = 0;
+      m_free.push_back(&b);
+   }
+   m_current = m_free.back();
+   m_free.pop_back();
+
+   if( m_splice && fcntl(m_fd, F_GETPIPE_SZ) < (int)m_buffer_size ) {
+      // best effort: a pipe that holds a whole buffer takes it in one
+      // vmsplice() (capped by /proc/sys/fs/pipe-max-size)
+      fcntl(m_fd, F_SETPIPE_SZ, (int)m_buffer_size);
+   }
+
+   if( use_uring ) {
+      setup_uring();
+   }
+
+   m_thread = new std::thread(&iq_writer::writer_loop, this);
+}
+
+void iq_writer::setup_uring()
+{
+   if( !m_is_file ) {
+      std::cerr << "iq_writer: io_uring output needs a regular file; using writev" << std::endl;
+      if( m_direct ) {
+         fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+         m_direct = false;
+      }
+      return;
+   }
+   std::vector<struct iovec> iov(m_buffers.size());
+   for( size_t i = 0; i < m_buffers.size(); ++i ) {
+      iov[i].iov_base = m_buffers[i].data;
+      iov[i].iov_len = m_buffer_size;
+   }
+   try {
+      m_uring = new uring_file(m_fd, std::min(m_buffers.size(), (size_t)256), iov);
+      m_max_batch = m_uring->depth();
+      m_backend = std::string("io_uring") + (m_uring->registered() ? ", registered buffers" : "")
+                  + (m_direct ? ", O_DIRECT" : "");
+   } catch( std::runtime_error& e ) {
+      std::cerr << "iq_writer: io_uring unavailable (" << e.what() << "); using pwritev" << std::endl;
+      m_uring = NULL;
+      if( m_direct ) {
+         fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+         m_direct = false;
+      }
+   }
+}
+
+iq_writer::~iq_writer()
+{
+   close();
+   for( buffer& b : m_buffers ) {
+      if( b.data ) {
+         free(b.data);
+      }
+   }
+}
+
+bool iq_writer::write(const void* data, size_t len)
+{
+   const char* src = (const char*)data;
+   while( len > 0 ) {
+      size_t n = std::min(len, m_buffer_size - m_current->len);
+      memcpy(m_current->data + m_current->len, src, n);
+      m_current->len += n;
+      src += n;
+      len -= n;
+      if( m_current->len == m_buffer_size ) {
+         submit_current();
+      }
+   }
+   std::lock_guard<std::mutex> lock(m_lock);
+   return !m_failed;
+}
+
+void iq_writer::submit_current()
+{
+   std::unique_lock<std::mutex> lock(m_lock);
+   m_full.push_back(m_current);
+   m_current = NULL;
+   ++m_stats.buffers;
+   m_stats.peak_backlog = std::max(m_stats.peak_backlog, (uint64_t)m_full.size());
+   m_full_avail.notify_one();
+
+   if( m_free.empty() ) {
+      // the writer can't keep up: this is the only place the sample loop
+      // waits, and it is measured
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      ++m_stats.stalls;
+      while( m_free.empty() ) {
+         m_free_avail.wait(lock);
+      }
+      m_stats.stall_seconds += std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start).count();
+   }
+   m_current = m_free.back();
+   m_free.pop_back();
+   m_current->len = 0;
+}
+
+void iq_writer::writer_loop()
+{
+   std::vector<buffer*> batch;
+   batch.reserve(m_buffers.size());
+
+   while( true ) {
+      {
+         std::unique_lock<std::mutex> lock(m_lock);
+         while( m_full.empty() && !m_stopping ) {
+            if( m_free.empty() && !m_in_pipe.empty() ) {
+               // the producer is waiting on buffers the pipe reader
+               // still has; nothing will wake us when it reads them
+               m_full_avail.wait_for(lock, std::chrono::milliseconds(1));
+               reclaim_spliced();
+            } else {
+               m_full_avail.wait(lock);
+            }
+         }
+         if( m_full.empty() ) {
+            break;
+         }
+         // take everything queued, up to what one writev accepts
+         while( !m_full.empty() && batch.size() < m_max_batch ) {
+            batch.push_back(m_full.front());
+            m_full.pop_front();
+         }
+      }
+
+      bool spliced = m_splice;
+      uint64_t end = m_offset;
+      bool ok = m_failed ? false :
+                m_uring ? write_buffers_uring(batch) : write_buffers(batch);
+
+      {
+         std::lock_guard<std::mutex> lock(m_lock);
+         if( !ok ) {
+            m_failed = true;
+         }
+         for( buffer* b : batch ) {
+            if( spliced && ok ) {
+               // each buffer's own end, so it comes back as soon as the
+               // reader is past it rather than past the whole batch
+               end += b->len;
+               m_in_pipe.push_back(std::make_pair(b, end));
+            } else {
+               m_free.push_back(b);
+            }
+         }
+         reclaim_spliced();
+      }
+      m_free_avail.notify_one();
+      batch.clear();
+   }
+}
+
+void iq_writer::reclaim_spliced()
+{
+   // called with m_lock held; wakes a producer waiting in submit_current()
+   // if anything comes back, since the poll in writer_loop() may be the
+   // only thing to notice the reader has caught up
+   if( m_in_pipe.empty() ) {
+      return;
+   }
+   int queued = 0;
+   if( 0 != ioctl(m_fd, FIONREAD, &queued) ) {
+      // can't tell; at most a pipe's worth can still be unread
+      queued = std::max(fcntl(m_fd, F_GETPIPE_SZ), 0);
+   }
+   uint64_t consumed = m_offset - std::min((uint64_t)queued, m_offset);
+   bool freed = false;
+   while( !m_in_pipe.empty() && m_in_pipe.front().second <= consumed ) {
+      m_free.push_back(m_in_pipe.front().first);
+      m_in_pipe.pop_front();
+      freed = true;
+   }
+   if( freed ) {
+      m_free_avail.notify_one();
+   }
+}
+
+bool iq_writer::write_buffers(std::vector<buffer*>& batch)
+{
+   struct iovec iov[IOV_MAX];
+   size_t count = batch.size();
+   for( size_t i = 0; i < count; ++i ) {
+      iov[i].iov_base = batch[i]->data;
+      iov[i].iov_len = batch[i]->len;
+   }
+
+   struct iovec* next = iov;
+   while( count > 0 ) {
+      ssize_t n;
+      if( m_is_file ) {
+         n = pwritev(m_fd, next, count, m_offset);
+      } else if( m_splice ) {
+         n = vmsplice(m_fd, next, count, 0);
+         if( n < 0 && (errno == EINVAL || errno == ENOSYS) ) {
+            std::cerr << "iq_writer: vmsplice unavailable (" << strerror(errno)
+                      << "); using writev" << std::endl;
+            m_splice = false;
+            m_backend = "writev";
+            continue;
+         }
+      } else {
+         n = writev(m_fd, next, count);
+      }
+      if( n < 0 ) {
+         if( errno == EINTR ) {
+            continue;
+         }
+         std::cerr << "iq_writer: write to " << m_filename << " failed: "
+                   << strerror(errno) << std::endl;
+         return false;
+      }
+      {
+         std::lock_guard<std::mutex> lock(m_lock);
+         ++m_stats.syscalls;
+         m_stats.bytes += n;
+         if( m_splice ) {
+            m_stats.zero_copy_bytes += n;
+         }
+      }
+      m_offset += n;
+      // skip what went out, including a partially written iovec
+      while( count > 0 && (size_t)n >= next->iov_len ) {
+         n -= next->iov_len;
+         ++next;
+         --count;
+      }
+      if( count > 0 ) {
+         next->iov_base = (char*)next->iov_base + n;
+         next->iov_len -= n;
+      }
+   }
+   return true;
+}
+
+bool iq_writer::write_buffers_uring(std::vector<buffer*>& batch)
+{
+   uring_file::write_op ops[256];
+   size_t count = batch.size();
+   uint64_t offset = m_offset;
+   for( size_t i = 0; i < count; ++i ) {
+      if( m_direct && (batch[i]->len % m_buffer_size) != 0 ) {
+         // Only the final, partial buffer gets here; O_DIRECT can't write
+         // an unaligned length, so finish up through the page cache.
+         fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+         m_direct = false;
+      }
+      ops[i].buf_index = batch[i] - m_buffers.data();
+      ops[i].len = batch[i]->len;
+      ops[i].offset = offset;
+      offset += batch[i]->len;
+   }
+
+   uint64_t enters = m_uring->enters();
+   bool ok = m_uring->write_all(ops, count);
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_stats.syscalls += m_uring->enters() - enters;
+      if( ok ) {
+         m_stats.bytes += offset - m_offset;
+      }
+   }
+   if( !ok ) {
+      std::cerr << "iq_writer: io_uring write to " << m_filename << " failed: "
+                << strerror(errno) << std::endl;
+      return false;
+   }
+   m_offset = offset;
+   return true;
+}
+
+void iq_writer::close()
+{
+   if( NULL == m_thread ) {
+      return;
+   }
+   {
+      std::lock_guard<std::mutex> lock(m_lock);
+      if( m_current->len > 0 ) {
+         m_full.push_back(m_current);
+         ++m_stats.buffers;
+      } else {
+         m_free.push_back(m_current);
+      }
+      m_current = NULL;
+      m_stopping = true;
+   }
+   m_full_avail.notify_one();
+   m_thread->join();
+   delete m_thread;
+   m_thread = NULL;
+   delete m_uring;
+   m_uring = NULL;
+
+   reclaim_spliced();
+   if( !m_in_pipe.empty() ) {
+      // The reader hasn't got to these yet and the pipe still points at
+      // their pages; leave them allocated so nothing can scribble on the
+      // data before it is read.
+      for( std::pair<buffer*, uint64_t>& p : m_in_pipe ) {
+         p.first->data = NULL;
+      }
+      m_in_pipe.clear();
+   }
+
+   if( m_is_file && m_expected_bytes > 0 ) {
+      // drop any preallocated tail that didn't get used
+      if( 0 != ftruncate(m_fd, m_offset) ) {
+         std::cerr << "iq_writer: failed to trim " << m_filename << ": "
+                   << strerror(errno) << std::endl;
+      }
+   }
+   if( m_fd != STDOUT_FILENO ) {
+      ::close(m_fd);
+   }
+   m_fd = -1;
+}
+
+iq_writer::writer_stats iq_writer::get_stats()
+{
+   std::lock_guard<std::mutex> lock(m_lock);
+   return m_stats;
+}
+
+void iq_writer::print_stats(std::ostream& os)
+{
+   writer_stats s = get_stats();
+   std::ios_base::fmtflags oldflags = os.flags();
+   std::streamsize oldprec = os.precision();
+   os << std::fixed << std::setprecision(1)
+      << "iq_writer (" << m_backend << "): wrote " << s.bytes / 1e6 << " MB in " << s.syscalls << " writes, "
+      << s.zero_copy_bytes / 1e6 << " MB zero-copy; "
+      << "peak backlog " << s.peak_backlog << " of " << m_buffers.size() << " buffers ("
+      << s.peak_backlog * m_buffer_size / 1e6 << " MB); "
+      << s.stalls << " stalls totalling " << s.stall_seconds * 1000 << " ms" << std::endl;
+   os.flags(oldflags);
+   os.precision(oldprec);
+}
@@ -0,0 +1,123 @@
+/*
+ * Asynchronous IQ output stage.
+ *
+ * The sample loop in ss_client copies each batch into one of a pool of
+ * large preallocated buffers and goes straight back to draining the
+ * sample FIFO; a dedicated thread writes full buffers out, several at a
+ * time with pwritev() for files or writev() for pipes and stdout. A disk
+ * or pipe stall therefore only grows the queue of full buffers instead of
+ * stopping the FIFO consumer, and the stats record how deep that queue
+ * got and how long the producer had to wait when the pool ran dry.
+ *
+ * When the output size is known up front, files are preallocated with
+ * fallocate() and trimmed to what was actually written on close().
+ *
+ * Pipes (the usual `ss_client iq ... - | decoder`) get writev() unless
+ * use_vmsplice is set, in which case full buffers are vmsplice()d into
+ * the pipe: it takes references to the buffer pages rather than copying
+ * them. A spliced buffer is reused once the pipe reports that its reader
+ * has consumed past the buffer's end, which is why the pool has to be
+ * well over the pipe size. That is only safe if the reader copies the
+ * data out with read(). A reader that splice()s or tee()s the pages on
+ * (pv, another pipe, a zero-copy socket send) still holds references
+ * after FIONREAD says they are gone, and sees later samples written over
+ * the ones it was given. Hence opt-in. Anything that refuses vmsplice()
+ * gets plain writev().
+ *
+ * Files can instead be written through io_uring (see uring_file), opened
+ * O_DIRECT so whole page-aligned buffers go to the device without a trip
+ * through the page cache. If io_uring isn't available the writer says so
+ * and carries on with pwritev().
+ */
+#ifndef IQ_WRITER_H
+#define IQ_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "uring_file.h"
+
+class iq_writer {
+public:
+   struct writer_stats {
+      uint64_t bytes = 0;          // bytes written out
+      uint64_t zero_copy_bytes = 0; // of which vmsplice()d into a pipe
+      uint64_t syscalls = 0;       // write/writev/pwritev calls
+      uint64_t buffers = 0;        // buffers handed to the writer thread
+      uint64_t peak_backlog = 0;   // most full buffers ever queued at once
+      uint64_t stalls = 0;         // times write() waited for a free buffer
+      double stall_seconds = 0;    // total time spent waiting
+   };
+
+   // filename "-" writes to stdout. buffer_size is rounded up to whole
+   // pages. expected_bytes, if known, is used to preallocate files.
+   // use_vmsplice only applies to pipes; see above for when it is safe.
+   iq_writer(const std::string& filename, size_t buffer_size, size_t buffer_count,
+             uint64_t expected_bytes = 0, bool use_uring = false, bool use_vmsplice = false);
+   ~iq_writer();
+
+   iq_writer(const iq_writer&) = delete;
+   iq_writer& operator=(const iq_writer&) = delete;
+
+   // Queue len bytes for output; only blocks when every buffer is full
+   // and waiting on the writer thread. Returns false once output failed.
+   bool write(const void* data, size_t len);
+
+   // Write out everything queued and close the output.
+   void close();
+
+   writer_stats get_stats();
+   void print_stats(std::ostream& os);
+
+private:
+   struct buffer {
+      char* data;
+      size_t len;
+   };
+
+   void writer_loop();
+   bool write_buffers(std::vector<buffer*>& batch);
+   bool write_buffers_uring(std::vector<buffer*>& batch);
+   void reclaim_spliced();
+   void setup_uring();
+   void submit_current();
+
+   std::string m_filename;
+   int m_fd;
+   bool m_is_file;      // regular file: positional writes, preallocation
+   uint64_t m_offset;   // next file offset, writer thread only
+   uint64_t m_expected_bytes;
+   size_t m_buffer_size;
+
+   std::vector<buffer> m_buffers;
+   buffer* m_current;   // being filled by write(), producer only
+
+   std::mutex m_lock;
+   std::condition_variable m_full_avail;
+   std::condition_variable m_free_avail;
+   std::deque<buffer*> m_full;
+   std::vector<buffer*> m_free;
+   bool m_stopping;
+   bool m_failed;
+   writer_stats m_stats;
+
+   std::thread* m_thread;
+
+   uring_file* m_uring;
+   bool m_direct;       // m_fd is O_DIRECT
+   size_t m_max_batch;  // buffers per write call
+   bool m_splice;       // m_fd is a pipe and takes vmsplice()
+   // spliced buffers and the stream offset of their end, oldest first;
+   // they belong to the pipe until its reader gets past that offset
+   std::deque<std::pair<buffer*, uint64_t> > m_in_pipe;
+   std::string m_backend;
+};
+
+#endif /* IQ_WRITER_H */
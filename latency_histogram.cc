@@ -0,0 +1,71 @@
+/*
+ * Log2-bucketed latency histogram.
+ */
+
+#include <algorithm>
+#include <iomanip>
+
+#include "latency_histogram.h"
+
+latency_histogram::latency_histogram() :
+   m_count(0),
+   m_sum(0),
+   m_max(0)
+{
+   for( int i = 0; i < Buckets; ++i ) {
+      m_buckets[i] = 0;
+   }
+}
+
+void latency_histogram::add(uint64_t usec)
+{
+   int idx = 0;
+   while( idx < Buckets - 1 && (uint64_t(1) << idx) <= usec ) {
+      ++idx;
+   }
+   ++m_buckets[idx];
+   ++m_count;
+   m_sum += usec;
+   if( usec > m_max ) {
+      m_max = usec;
+   }
+}
+
+uint64_t latency_histogram::quantile(double q) const
+{
+   uint64_t target = q * m_count;
+   uint64_t seen = 0;
+   for( int i = 0; i < Buckets; ++i ) {
+      seen += m_buckets[i];
+      if( seen > target ) {
+         return std::min(uint64_t(1) << i, m_max);
+      }
+   }
+   return m_max;
+}
+
+void latency_histogram::print(std::ostream& os, const std::string& title) const
+{
+   if( 0 == m_count ) {
+      return;
+   }
+
+   auto oldflags = os.flags();
+   auto oldprec = os.precision();
+   os << std::fixed << std::setprecision(3)
+      << title << m_count << ", mean " << (m_sum / (double)m_count) / 1000.0
+      << " ms, p50 < " << quantile(0.5) / 1000.0
+      << " ms, p99 < " << quantile(0.99) / 1000.0
+      << " ms, max " << m_max / 1000.0 << " ms" << std::endl;
+
+   for( int i = 0; i < Buckets; ++i ) {
+      if( m_buckets[i] == 0 ) {
+         continue;
+      }
+      os << "   < " << std::setw(10) << (uint64_t(1) << i) / 1000.0 << " ms: "
+         << std::setw(8) << m_buckets[i] << "  "
+         << std::string((size_t)(50.0 * m_buckets[i] / m_count + 0.5), '#') << std::endl;
+   }
+   os.flags(oldflags);
+   os.precision(oldprec);
+}
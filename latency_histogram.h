@@ -0,0 +1,35 @@
+/*
+ * Log2-bucketed latency histogram.
+ *
+ * Bucket i counts samples in [2^(i-1), 2^i) microseconds (bucket 0 is
+ * < 1 us). Single writer; read it once the writer has stopped.
+ */
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+class latency_histogram {
+public:
+   static constexpr int Buckets = 32;
+
+   latency_histogram();
+
+   void add(uint64_t usec);
+   uint64_t count() const { return m_count; }
+   // upper bound of the bucket holding the given quantile (0..1), in usec,
+   // capped at the largest value seen
+   uint64_t quantile(double q) const;
+   // one summary line starting with title, then one line per non-empty bucket
+   void print(std::ostream& os, const std::string& title) const;
+
+private:
+   uint64_t m_buckets[Buckets];
+   uint64_t m_count;
+   uint64_t m_sum;
+   uint64_t m_max;
+};
+
+#endif /* LATENCY_HISTOGRAM_H */
@@ -0,0 +1,352 @@
+/*
+ * Spectrum log writer.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "power_writer.h"
+
+// room for one formatted number plus its ", " separator
+static const size_t MaxFieldLen = 64;
+
+static_assert(sizeof(power_writer::bin_header) == 64, "bin_header layout");
+static_assert(sizeof(power_writer::row_prefix) == 16, "row_prefix layout");
+static_assert(sizeof(power_writer::idx_record) == 16, "idx_record layout");
+
+power_writer::power_writer(const std::string& filename, format fmt,
+                           uint32_t integration_seconds, uint32_t rotate_seconds) :
+   m_filename(filename),
+   m_format(fmt),
+   m_fd(-1),
+   m_idx_fd(-1),
+   m_is_stdout(filename == "-"),
+   m_failed(false),
+   m_rotate_failed(false),
+   m_integration_seconds(integration_seconds),
+   m_rotate_seconds(m_is_stdout ? 0 : rotate_seconds),
+   m_file_start(0),
+   m_file_bytes(0),
+   m_row_len(0),
+   m_hz_low(0),
+   m_hz_high(0),
+   m_hz_step(0),
+   m_first_bin(0),
+   m_last_bin(0),
+   m_db_at_zero(0),
+   m_db_per_unit(1),
+   m_fixed_point(false),
+   m_layout_written(false)
+{
+   open_file();
+}
+
+power_writer::~power_writer()
+{
+   close_file();
+}
+
+void power_writer::open_file()
+{
+   m_file_start = 0;
+   m_file_bytes = 0;
+   m_layout_written = false;
+
+   if( m_is_stdout ) {
+      m_fd = STDOUT_FILENO;
+      return;
+   }
+   m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+   if( m_fd < 0 ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Failed to open " + m_filename + ": " + strerror(errno) );
+   }
+   if( m_format == BINARY ) {
+      std::string idx = m_filename + ".idx";
+      m_idx_fd = open(idx.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+      if( m_idx_fd < 0 ) {
+         throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                   "Failed to open " + idx + ": " + strerror(errno) );
+      }
+   }
+}
+
+void power_writer::close_file()
+{
+   if( m_fd >= 0 && !m_is_stdout ) {
+      close(m_fd);
+   }
+   if( m_idx_fd >= 0 ) {
+      close(m_idx_fd);
+   }
+   m_fd = -1;
+   m_idx_fd = -1;
+}
+
+// Renames the current file (and index) out of the way and starts fresh
+// ones. If either rename fails nothing is closed or truncated: the rows
+// keep going to the current files and the next call tries again.
+bool power_writer::rotate()
+{
+   char stamp[32];
+   struct tm tm;
+   std::time_t start = m_file_start;
+   localtime_r(&start, &tm);
+   strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+   std::string done = m_filename + "." + stamp;
+   std::string idx = m_filename + ".idx";
+   // the index goes first, as it is the one that can be put back
+   if( m_format == BINARY && 0 != rename(idx.c_str(), (done + ".idx").c_str()) ) {
+      rotate_failed(idx, done + ".idx");
+      return false;
+   }
+   if( 0 != rename(m_filename.c_str(), done.c_str()) ) {
+      int err = errno;
+      if( m_format == BINARY ) {
+         rename((done + ".idx").c_str(), idx.c_str());
+      }
+      errno = err;
+      rotate_failed(m_filename, done);
+      return false;
+   }
+   m_rotate_failed = false;
+
+   close_file();
+   open_file();
+   return true;
+}
+
+void power_writer::rotate_failed(const std::string& from, const std::string& to)
+{
+   // once per run of failures, not once per row
+   if( !m_rotate_failed ) {
+      std::cerr << "power_writer: failed to rotate " << from << " to " << to
+                << ": " << strerror(errno) << "; appending to " << m_filename << std::endl;
+   }
+   m_rotate_failed = true;
+}
+
+void power_writer::set_layout(double fft_hz_low, double hz_step, size_t bins,
+                              double low_limit, double high_limit)
+{
+   m_hz_step = hz_step;
+   m_first_bin = 0;
+   m_last_bin = bins > 0 ? bins - 1 : 0;
+
+   // same rounding as rtl_power's crop: the first bin at or above
+   // low_limit, the last one at or below the first bin past high_limit
+   if( fft_hz_low < low_limit ) {
+      m_first_bin = std::min((size_t)std::ceil((low_limit - fft_hz_low) / hz_step), m_last_bin);
+   }
+   double fft_hz_high = fft_hz_low + hz_step * bins;
+   if( fft_hz_high > high_limit && high_limit > fft_hz_low ) {
+      m_last_bin = std::min((size_t)std::ceil((high_limit - fft_hz_low) / hz_step), m_last_bin);
+   }
+   m_hz_low = fft_hz_low + hz_step * m_first_bin;
+   m_hz_high = fft_hz_low + hz_step * (m_last_bin + 1);
+
+   // a full row, so formatting never has to grow the buffer
+   m_row.resize((m_last_bin - m_first_bin + 1 + 8) * MaxFieldLen);
+
+   if( m_format == BINARY && m_layout_written ) {
+      // the header describes every row in a file, so start another
+      if( m_is_stdout ) {
+         m_layout_written = false;
+      } else if( !rotate() ) {
+         // rows of another size under the old header would garble the
+         // whole file, so keep what is there and stop logging
+         std::cerr << "power_writer: layout changed but " << m_filename
+                   << " could not be rotated; logging stopped" << std::endl;
+         m_failed = true;
+      }
+   }
+}
+
+void power_writer::set_units(double db_at_zero, double db_per_unit)
+{
+   m_db_at_zero = db_at_zero;
+   m_db_per_unit = db_per_unit;
+}
+
+void power_writer::append(const char* text, size_t len)
+{
+   memcpy(m_row.data() + m_row_len, text, len);
+   m_row_len += len;
+}
+
+template <class T>
+void power_writer::append_number(T value)
+{
+   char* start = m_row.data() + m_row_len;
+   std::to_chars_result res = std::to_chars(start, start + MaxFieldLen, value);
+   m_row_len = res.ptr - m_row.data();
+}
+
+template <class T>
+void power_writer::append_number(T value, int precision)
+{
+   char* start = m_row.data() + m_row_len;
+   std::to_chars_result res = std::to_chars(start, start + MaxFieldLen, value,
+                                            std::chars_format::fixed, precision);
+   m_row_len = res.ptr - m_row.data();
+}
+
+template <class T>
+void power_writer::append_value(T value)
+{
+   // rows are native little-endian, like the IQ output
+   append((const char*)&value, sizeof(value));
+}
+
+void power_writer::begin_row(std::chrono::system_clock::time_point when, uint32_t samples)
+{
+   std::time_t secs = std::chrono::system_clock::to_time_t(when);
+
+   if( m_rotate_seconds > 0 && m_file_start != 0 &&
+       secs - m_file_start >= (std::time_t)m_rotate_seconds ) {
+      rotate();
+   }
+   if( m_file_start == 0 ) {
+      m_file_start = secs;
+   }
+
+   m_row_len = 0;
+   if( m_format == BINARY ) {
+      row_prefix prefix;
+      prefix.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          when.time_since_epoch()).count();
+      prefix.samples = samples;
+      prefix.reserved = 0;
+      append_value(prefix);
+   } else {
+      begin_csv_row(secs, samples);
+   }
+}
+
+void power_writer::begin_csv_row(std::time_t when, uint32_t samples)
+{
+   struct tm tm;
+   localtime_r(&when, &tm);
+   m_row_len = strftime(m_row.data(), MaxFieldLen, "%Y-%m-%d, %H:%M:%S", &tm);
+
+   append(", ", 2);
+   append_number((uint64_t)m_hz_low);
+   append(", ", 2);
+   append_number((uint64_t)m_hz_high);
+   append(", ", 2);
+   append_number(m_hz_step, 2);
+   append(", ", 2);
+   append_number(samples);
+}
+
+void power_writer::add(double db)
+{
+   if( m_format == BINARY ) {
+      m_fixed_point = false;
+      append_value((float)db);
+   } else {
+      append(", ", 2);
+      append_number(db, 2);
+   }
+}
+
+void power_writer::add(uint32_t sum, uint32_t periods)
+{
+   if( m_format == BINARY ) {
+      // 8.8 fixed point keeps the fraction the integer mean throws away
+      m_fixed_point = true;
+      append_value((uint16_t)std::min(((uint64_t)sum * 256 + periods / 2) / periods, (uint64_t)UINT16_MAX));
+   } else {
+      append(", ", 2);
+      append_number(sum / periods);
+   }
+}
+
+bool power_writer::write_all(int fd, const char* data, size_t len)
+{
+   while( len > 0 ) {
+      ssize_t n = write(fd, data, len);
+      if( n < 0 ) {
+         if( errno == EINTR ) {
+            continue;
+         }
+         // keep the receiver running; just stop logging
+         std::cerr << "power_writer: write to " << m_filename << " failed: "
+                   << strerror(errno) << std::endl;
+         m_failed = true;
+         return false;
+      }
+      data += n;
+      len -= n;
+   }
+   return true;
+}
+
+bool power_writer::end_row()
+{
+   if( m_failed ) {
+      return false;
+   }
+
+   if( m_format == CSV ) {
+      append("\n", 1);
+      return write_all(m_fd, m_row.data(), m_row_len);
+   }
+
+   if( !m_layout_written ) {
+      bin_header header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, "SSPOWER1", sizeof(header.magic));
+      header.header_size = sizeof(header);
+      header.row_size = m_row_len;
+      header.bins = m_last_bin - m_first_bin + 1;
+      header.value_type = m_fixed_point ? 1 : 0;
+      header.hz_low = m_hz_low;
+      header.hz_step = m_hz_step;
+      header.center_freq = (m_hz_low + m_hz_high) / 2;
+      header.value_scale = m_fixed_point ? m_db_per_unit / 256 : 1;
+      header.value_offset = m_fixed_point ? m_db_at_zero : 0;
+      header.integration_seconds = m_integration_seconds;
+      if( !write_all(m_fd, (const char*)&header, sizeof(header)) ) {
+         return false;
+      }
+      m_file_bytes += sizeof(header);
+
+      if( m_idx_fd >= 0 ) {
+         idx_header ih;
+         memcpy(ih.magic, "SSPIDX1", sizeof(ih.magic));
+         ih.header_size = sizeof(ih);
+         ih.record_size = sizeof(idx_record);
+         if( !write_all(m_idx_fd, (const char*)&ih, sizeof(ih)) ) {
+            return false;
+         }
+      }
+      m_layout_written = true;
+   }
+
+   idx_record rec;
+   memcpy(&rec.time_us, m_row.data(), sizeof(rec.time_us));
+   rec.offset = m_file_bytes;
+
+   if( !write_all(m_fd, m_row.data(), m_row_len) ) {
+      return false;
+   }
+   m_file_bytes += m_row_len;
+
+   // the index entry goes out after its row, so anything it points at is
+   // already in the data file
+   if( m_idx_fd >= 0 ) {
+      return write_all(m_idx_fd, (const char*)&rec, sizeof(rec));
+   }
+   return true;
+}
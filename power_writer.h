@@ -0,0 +1,148 @@
+/*
+ * Spectrum log writer.
+ *
+ * The output file is opened once, truncated as rtl_power does, and each
+ * report is appended as one row. Rows are assembled in a reused buffer
+ * and handed to the file in a single write(), so readers never see a
+ * partial row and the steady state neither allocates nor goes through
+ * iostreams.
+ *
+ * Two formats are supported:
+ *
+ * CSV, compatible with rtl_power:
+ *
+ *   date, time, Hz low, Hz high, Hz step, samples, dB, dB, dB, ...
+ *
+ * with numbers formatted by std::to_chars.
+ *
+ * BINARY, little-endian, about a tenth of the size and nothing to parse:
+ * a bin_header, then fixed-size rows of a row_prefix followed by bins
+ * values, either float32 dB or uint16 (see bin_header::value_type). Next
+ * to it, <filename>.idx holds an idx_header and one idx_record per row in
+ * time order, so a reader can mmap the index and binary search it for a
+ * time range without touching the data file.
+ *
+ * Optionally the file is rotated every rotate_seconds: the finished file
+ * (and index) is renamed to <filename>.<YYYYmmdd-HHMMSS of its first row>
+ * and a fresh one started under the original name, so tools watching that
+ * name keep working while a long run keeps its full history. If the rename
+ * fails the rows keep going to the current file and the rotation is retried
+ * with the next row.
+ */
+#ifndef POWER_WRITER_H
+#define POWER_WRITER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+class power_writer {
+public:
+   enum format { CSV, BINARY };
+
+   struct bin_header {
+      char magic[8];          // "SSPOWER1"
+      uint32_t header_size;   // sizeof(bin_header); rows start here
+      uint32_t row_size;      // bytes per row, including its row_prefix
+      uint32_t bins;
+      uint32_t value_type;    // 0: float32, 1: uint16
+      double center_freq;     // Hz
+      double hz_low;          // frequency of the first bin
+      double hz_step;
+      float value_scale;      // dB = value * value_scale + value_offset
+      float value_offset;
+      uint32_t integration_seconds;
+      uint32_t reserved;
+   };
+
+   struct row_prefix {
+      int64_t time_us;        // unix time of the start of the integration
+      uint32_t samples;       // fft frames averaged into the row
+      uint32_t reserved;
+   };
+
+   struct idx_header {
+      char magic[8];          // "SSPIDX1\0"
+      uint32_t header_size;   // sizeof(idx_header)
+      uint32_t record_size;   // sizeof(idx_record)
+   };
+
+   struct idx_record {
+      int64_t time_us;        // same as the row's row_prefix::time_us
+      uint64_t offset;        // byte offset of the row in the data file
+   };
+
+   // filename "-" writes to stdout (never rotated, no index)
+   power_writer(const std::string& filename, format fmt = CSV,
+                uint32_t integration_seconds = 0, uint32_t rotate_seconds = 0);
+   ~power_writer();
+
+   power_writer(const power_writer&) = delete;
+   power_writer& operator=(const power_writer&) = delete;
+
+   // Describe the FFT: bins bins of hz_step starting at fft_hz_low. Only
+   // bins inside [low_limit, high_limit] are written; the window is worked
+   // out here, once, rather than per bin per row.
+   void set_layout(double fft_hz_low, double hz_step, size_t bins,
+                   double low_limit, double high_limit);
+   size_t first_bin() const { return m_first_bin; }
+   size_t last_bin() const { return m_last_bin; } // inclusive
+
+   // For rows built from add(sum, periods): the dB value of a server bin
+   // value of 0 and the dB step per unit, recorded in the binary header.
+   void set_units(double db_at_zero, double db_per_unit);
+
+   // Build a row: begin_row(), then add() once per bin from first_bin()
+   // through last_bin(), then end_row() to write it out. Use one add()
+   // overload per file: a dB value, or the sum of periods server bin
+   // values (written as their integer mean in CSV, 8.8 fixed point in
+   // binary).
+   void begin_row(std::chrono::system_clock::time_point when, uint32_t samples);
+   void add(double db);
+   void add(uint32_t sum, uint32_t periods);
+   bool end_row();
+
+private:
+   void open_file();
+   void close_file();
+   bool rotate();
+   void rotate_failed(const std::string& from, const std::string& to);
+   void begin_csv_row(std::time_t when, uint32_t samples);
+   bool write_all(int fd, const char* data, size_t len);
+   void append(const char* text, size_t len);
+   template <class T> void append_number(T value);
+   template <class T> void append_number(T value, int precision);
+   template <class T> void append_value(T value);
+
+   std::string m_filename;
+   format m_format;
+   int m_fd;
+   int m_idx_fd;
+   bool m_is_stdout;
+   bool m_failed;
+   bool m_rotate_failed;   // the last rotation attempt failed and was logged
+   uint32_t m_integration_seconds;
+   uint32_t m_rotate_seconds;
+   std::time_t m_file_start; // time of the first row in the current file
+   uint64_t m_file_bytes;
+
+   std::vector<char> m_row;
+   size_t m_row_len;
+
+   // precomputed per-layout row prefix fields
+   double m_hz_low;
+   double m_hz_high;
+   double m_hz_step;
+   size_t m_first_bin;
+   size_t m_last_bin;
+
+   double m_db_at_zero;
+   double m_db_per_unit;
+   bool m_fixed_point;     // binary rows are uint16 rather than float32
+   bool m_layout_written;  // binary header matches the current layout
+};
+
+#endif /* POWER_WRITER_H */
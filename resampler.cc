@@ -0,0 +1,323 @@
+/*
+ * Polyphase rational resampler for interleaved complex (I/Q) samples.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "resampler.h"
+#include "sample_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86 1
+#endif
+
+// complex samples converted per pass by the integer process() versions
+static const size_t StageSamples = 4096;
+
+namespace {
+
+// x holds taps complex samples, h the matching coefficients, each one
+// repeated for I and Q; taps is a multiple of 4
+
+void dot_scalar(const float* x, const float* h, size_t taps, float* out)
+{
+   float i_acc = 0;
+   float q_acc = 0;
+   for( size_t k = 0; k < taps * 2; k += 2 ) {
+      i_acc += x[k] * h[k];
+      q_acc += x[k + 1] * h[k + 1];
+   }
+   out[0] = i_acc;
+   out[1] = q_acc;
+}
+
+#ifdef RESAMPLER_X86
+
+__attribute__((target("sse2")))
+void dot_sse2(const float* x, const float* h, size_t taps, float* out)
+{
+   // two accumulators to keep the adds from waiting on each other
+   __m128 acc0 = _mm_setzero_ps();
+   __m128 acc1 = _mm_setzero_ps();
+   for( size_t k = 0; k < taps * 2; k += 8 ) {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(h + k + 4)));
+   }
+   // lanes are I, Q, I, Q
+   __m128 acc = _mm_add_ps(acc0, acc1);
+   acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+   _mm_storel_pi((__m64*)out, acc);
+}
+
+__attribute__((target("avx2")))
+void dot_avx2(const float* x, const float* h, size_t taps, float* out)
+{
+   __m256 acc0 = _mm256_setzero_ps();
+   __m256 acc1 = _mm256_setzero_ps();
+   size_t k = 0;
+   for( ; k + 16 <= taps * 2; k += 16 ) {
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(h + k)));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(x + k + 8), _mm256_loadu_ps(h + k + 8)));
+   }
+   if( k < taps * 2 ) {
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(h + k)));
+   }
+   __m256 acc = _mm256_add_ps(acc0, acc1);
+   __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+   sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+   _mm_storel_pi((__m64*)out, sum);
+}
+
+#define DOT_VARIANTS dot_avx2, dot_sse2, dot_scalar
+
+#else
+
+#define DOT_VARIANTS NULL, NULL, dot_scalar
+
+#endif
+
+typedef void (*dot_fn)(const float*, const float*, size_t, float*);
+
+dot_fn select_dot(dot_fn avx2, dot_fn sse2, dot_fn scalar)
+{
+#ifdef RESAMPLER_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+void dot(const float* x, const float* h, size_t taps, float* out)
+{
+   static const dot_fn impl = select_dot(DOT_VARIANTS);
+   impl(x, h, taps, out);
+}
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x)
+{
+   double sum = 1;
+   double term = 1;
+   for( int k = 1; k < 50; ++k ) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+      if( term < sum * 1e-17 ) {
+         break;
+      }
+   }
+   return sum;
+}
+
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+   while( b != 0 ) {
+      uint64_t t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+struct preset {
+   uint32_t taps;          // complex taps per phase when not decimating
+   double attenuation;     // stopband, dB
+};
+
+// indexed by poly_resampler::quality; hold and linear have no sinc design
+const preset Presets[] = {
+   { 160, 110 },
+   { 64, 97 },
+   { 32, 90 },
+};
+
+} // namespace
+
+const uint32_t poly_resampler::MaxPhases;
+
+poly_resampler::poly_resampler(double input_rate, double output_rate, int quality) :
+   m_up(1),
+   m_down(1),
+   m_phases(1),
+   m_taps(4),
+   m_delay(0),
+   m_cap(0),
+   m_pos(0),
+   m_phase(0),
+   m_skip(0)
+{
+   if( !(input_rate > 0) || !(output_rate > 0) ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " + "Sample rates must be positive" );
+   }
+   if( quality < BEST || quality > LINEAR ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Unknown resampler quality " + std::to_string(quality) );
+   }
+
+   // decimated spyserver rates can have a fractional part (10 MHz / 256),
+   // so scale both up until they are whole before reducing L/M
+   double in = input_rate;
+   double out = output_rate;
+   for( int i = 0; i < 16 && (in != std::floor(in) || out != std::floor(out)); ++i ) {
+      in *= 2;
+      out *= 2;
+   }
+   m_up = (uint64_t)std::llround(out);
+   m_down = (uint64_t)std::llround(in);
+   uint64_t div = gcd(m_up, m_down);
+   m_up /= div;
+   m_down /= div;
+   m_phases = (uint32_t)std::min<uint64_t>(m_up, MaxPhases);
+
+   design(quality);
+
+   m_cap = 1;
+   while( m_cap < m_taps ) {
+      m_cap <<= 1;
+   }
+   m_ring.assign(m_cap * 2 * 2, 0.0f);
+
+   m_stage_in.resize(StageSamples * 2);
+   m_stage_out.resize(max_output(StageSamples) * 2);
+}
+
+void poly_resampler::design(int quality)
+{
+   const uint32_t P = m_phases;
+   std::vector<double> proto;
+   uint32_t len;  // complex taps actually used, before padding
+
+   if( quality == ZERO_ORDER_HOLD ) {
+      len = 1;
+      proto.assign(P, 1.0);
+      m_delay = 0;
+   } else if( quality == LINEAR ) {
+      // a triangle two inputs wide: phase q weighs the newest sample by
+      // q/P and the one before by 1 - q/P
+      len = 2;
+      proto.resize(2 * P);
+      for( uint32_t j = 0; j < 2 * P; ++j ) {
+         proto[j] = j < P ? double(j) / P : double(2 * P - j) / P;
+      }
+      m_delay = 1;
+   } else {
+      const preset& p = Presets[quality];
+      // when decimating, the cutoff follows the output band and the filter
+      // gets proportionally longer to keep the same transition width
+      double ratio = std::min(1.0, double(m_up) / m_down);
+      len = (uint32_t)std::ceil(p.taps / ratio);
+      // Kaiser design: transition width in input-rate units for this
+      // length and attenuation, with the stopband starting at Nyquist
+      double transition = (p.attenuation - 7.95) / (14.36 * p.taps);
+      double cutoff = (1.0 - transition) * ratio;  // fraction of input Nyquist
+      double beta = 0.1102 * (p.attenuation - 8.7);
+
+      uint32_t n = len * P;
+      double center = (n - 1) / 2.0;
+      proto.resize(n);
+      for( uint32_t j = 0; j < n; ++j ) {
+         double t = (j - center) / P;  // in input samples
+         double arg = M_PI * cutoff * t;
+         double sinc = t == 0 ? 1.0 : std::sin(arg) / arg;
+         double r = (j - center) / center;
+         double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel_i0(beta);
+         proto[j] = cutoff * sinc * window;
+      }
+      m_delay = center / P;
+   }
+
+   // pad to whole SIMD steps; the padding sits at the old end and is zero
+   m_taps = (len + 3) & ~3u;
+   m_bank.assign((size_t)P * m_taps * 2, 0.0f);
+   for( uint32_t q = 0; q < P; ++q ) {
+      float* row = &m_bank[(size_t)q * m_taps * 2];
+      // unity gain at DC for every phase, so the phases don't ripple
+      double sum = 0;
+      for( uint32_t k = 0; k < len; ++k ) {
+         sum += proto[(size_t)k * P + q];
+      }
+      if( sum == 0 ) {
+         sum = 1;
+      }
+      // y = sum over k of x[newest - k] * proto[k * P + q]
+      for( uint32_t k = 0; k < len; ++k ) {
+         float c = (float)(proto[(size_t)k * P + q] / sum);
+         size_t slot = m_taps - 1 - k;
+         row[slot * 2] = c;
+         row[slot * 2 + 1] = c;
+      }
+   }
+}
+
+size_t poly_resampler::max_output(size_t in_samples) const
+{
+   return (size_t)((in_samples * m_up) / m_down) + 1;
+}
+
+size_t poly_resampler::process(const float* in, size_t in_samples, float* out)
+{
+   const uint32_t mask = m_cap - 1;
+   const bool exact = m_phases == m_up;
+   size_t produced = 0;
+
+   for( size_t s = 0; s < in_samples; ++s ) {
+      float* slot = &m_ring[m_pos * 2];
+      slot[0] = slot[m_cap * 2] = in[s * 2];
+      slot[1] = slot[m_cap * 2 + 1] = in[s * 2 + 1];
+
+      // newest taps samples, ending with the one just stored; the mirror
+      // keeps them contiguous across the wrap
+      const float* window = &m_ring[(m_pos + m_cap - m_taps + 1) * 2];
+      while( m_skip == 0 ) {
+         uint64_t q = exact ? m_phase : m_phase * m_phases / m_up;
+         dot(window, &m_bank[q * m_taps * 2], m_taps, out + produced * 2);
+         ++produced;
+         m_phase += m_down;
+         m_skip = m_phase / m_up;
+         m_phase %= m_up;
+      }
+      --m_skip;
+      m_pos = (m_pos + 1) & mask;
+   }
+   return produced;
+}
+
+template <class T>
+size_t poly_resampler::process_staged(const T* in, size_t in_samples, T* out,
+                                      void (*to_float)(const T*, float*, size_t),
+                                      void (*from_float)(const float*, T*, size_t))
+{
+   size_t produced = 0;
+   while( in_samples > 0 ) {
+      size_t n = std::min(in_samples, StageSamples);
+      to_float(in, m_stage_in.data(), n * 2);
+      size_t got = process(m_stage_in.data(), n, m_stage_out.data());
+      from_float(m_stage_out.data(), out + produced * 2, got * 2);
+      produced += got;
+      in += n * 2;
+      in_samples -= n;
+   }
+   return produced;
+}
+
+size_t poly_resampler::process(const int16_t* in, size_t in_samples, int16_t* out)
+{
+   return process_staged(in, in_samples, out, int16_to_float, float_to_int16);
+}
+
+size_t poly_resampler::process(const int32_t* in, size_t in_samples, int32_t* out)
+{
+   return process_staged(in, in_samples, out, int32_to_float, float_to_int32);
+}
@@ -0,0 +1,90 @@
+/*
+ * Polyphase rational resampler for interleaved complex (I/Q) samples.
+ *
+ * The output/input rate ratio is reduced to L/M and a lowpass prototype
+ * is designed once, at construction, and split into a bank of L phases
+ * of taps() coefficients each. Every output sample is then a single dot
+ * product of the newest taps() inputs with one phase, done with SSE2 or
+ * AVX2 where the CPU has them. Ratios whose L exceeds MaxPhases keep the
+ * exact output rate, but each output uses the nearest earlier of
+ * MaxPhases phases, i.e. its timing is quantised to 1/MaxPhases of an
+ * input sample.
+ *
+ * Input history lives in a mirrored ring: every sample is stored twice,
+ * Cap samples apart, so the newest taps() samples are always contiguous
+ * and nothing is ever moved. process() consumes all the input it is
+ * given; there is no leftover for the caller to carry over.
+ *
+ * Quality presets keep the numbering of libsamplerate's converters, which
+ * -l used to select, with the -6 dB point at about the same fraction of
+ * the output band:
+ *
+ *   BEST             ~96% of the band, ~110 dB stopband
+ *   MEDIUM           ~90%, ~97 dB
+ *   FASTEST          ~82%, ~90 dB
+ *   ZERO_ORDER_HOLD  repeats the most recent input sample
+ *   LINEAR           interpolates between the two most recent samples
+ *
+ * The filter delays the signal by delay() input samples.
+ */
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class poly_resampler {
+public:
+   enum quality { BEST = 0, MEDIUM = 1, FASTEST = 2, ZERO_ORDER_HOLD = 3, LINEAR = 4 };
+
+   static const uint32_t MaxPhases = 1024;
+
+   poly_resampler(double input_rate, double output_rate, int quality);
+
+   // most output samples process() can produce from in_samples inputs
+   size_t max_output(size_t in_samples) const;
+
+   // Resample in_samples complex samples into out, which must have room
+   // for max_output(in_samples). Returns the number of samples written.
+   // The integer versions round and saturate on the way out.
+   size_t process(const float* in, size_t in_samples, float* out);
+   size_t process(const int16_t* in, size_t in_samples, int16_t* out);
+   size_t process(const int32_t* in, size_t in_samples, int32_t* out);
+
+   uint64_t interpolation() const { return m_up; }
+   uint64_t decimation() const { return m_down; }
+   uint32_t taps() const { return m_taps; }
+   uint32_t phases() const { return m_phases; }
+   double delay() const { return m_delay; }
+
+private:
+   void design(int quality);
+
+   template <class T>
+   size_t process_staged(const T* in, size_t in_samples, T* out,
+                         void (*to_float)(const T*, float*, size_t),
+                         void (*from_float)(const float*, T*, size_t));
+
+   uint64_t m_up;          // L
+   uint64_t m_down;        // M
+   uint32_t m_phases;      // phases in the bank, L or MaxPhases
+   uint32_t m_taps;        // complex taps per phase, a multiple of 4
+   double m_delay;
+
+   // phase rows of 2 * m_taps floats, each coefficient repeated for I and
+   // Q and ordered oldest sample first
+   std::vector<float> m_bank;
+
+   std::vector<float> m_ring;  // 2 * m_cap complex samples
+   uint32_t m_cap;             // power of two >= m_taps
+   uint32_t m_pos;             // next write position, < m_cap
+
+   uint64_t m_phase;       // position of the next output between inputs, in 1/L
+   uint64_t m_skip;        // inputs to take before the next output is due
+
+   std::vector<float> m_stage_in;
+   std::vector<float> m_stage_out;
+};
+
+#endif /* RESAMPLER_H */
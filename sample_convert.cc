@@ -0,0 +1,568 @@
+/*
+ * Sample format conversion kernels.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "sample_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SAMPLE_CONVERT_X86 1
+#endif
+
+namespace {
+
+void unpack_int24_scalar(const uint8_t* in, int32_t* out, size_t count)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      // assemble in the top three bytes; the sign comes along for free
+      out[i] = (int32_t)(((uint32_t)in[0] << 8) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 24));
+      in += 3;
+   }
+}
+
+#ifdef SAMPLE_CONVERT_X86
+
+// byte shuffle taking 12 packed bytes to 4 int32 with a zero low byte
+#define INT24_SHUFFLE -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+
+__attribute__((target("ssse3")))
+void unpack_int24_ssse3(const uint8_t* in, int32_t* out, size_t count)
+{
+   const __m128i shuffle = _mm_setr_epi8(INT24_SHUFFLE);
+   size_t i = 0;
+   // each step reads 16 bytes but consumes 12, so stop while 16 remain
+   for( ; i + 6 <= count; i += 4 ) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i * 3));
+      _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(v, shuffle));
+   }
+   unpack_int24_scalar(in + i * 3, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void unpack_int24_avx2(const uint8_t* in, int32_t* out, size_t count)
+{
+   const __m256i shuffle = _mm256_setr_epi8(INT24_SHUFFLE, INT24_SHUFFLE);
+   size_t i = 0;
+   // two 12-byte groups per step, one per 128-bit lane; the second load
+   // reads 4 bytes past the 24 consumed, so keep 2 values in hand
+   for( ; i + 10 <= count; i += 8 ) {
+      const uint8_t* src = in + i * 3;
+      __m256i v = _mm256_inserti128_si256(
+                     _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src)),
+                     _mm_loadu_si128((const __m128i*)(src + 12)), 1);
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(v, shuffle));
+   }
+   unpack_int24_ssse3(in + i * 3, out + i, count - i);
+}
+
+#endif
+
+// largest floats that still convert to an in-range integer
+static const float Int16Max = 32767.0f;
+static const float Int16Min = -32768.0f;
+static const float Int32Max = 2147483520.0f;
+static const float Int32Min = -2147483648.0f;
+
+void int16_to_float_scalar(const int16_t* in, float* out, size_t count)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      out[i] = in[i];
+   }
+}
+
+void float_to_int16_scalar(const float* in, int16_t* out, size_t count)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      out[i] = (int16_t)lrintf(std::fmin(std::fmax(in[i], Int16Min), Int16Max));
+   }
+}
+
+void int32_to_float_scalar(const int32_t* in, float* out, size_t count)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      out[i] = (float)in[i];
+   }
+}
+
+void float_to_int32_scalar(const float* in, int32_t* out, size_t count)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      out[i] = (int32_t)lrintf(std::fmin(std::fmax(in[i], Int32Min), Int32Max));
+   }
+}
+
+void uint8_to_float_scalar(const uint8_t* in, float* out, size_t count, float scale)
+{
+   for( size_t i = 0; i < count; ++i ) {
+      out[i] = ((int)in[i] - 128) * scale;
+   }
+}
+
+inline uint32_t xorshift32(uint32_t& s)
+{
+   s ^= s << 13;
+   s ^= s >> 17;
+   s ^= s << 5;
+   return s;
+}
+
+// float -> cs8, or cu8 with flip 0x80: optional TPDF dither of +-1 LSB
+// from rng, round, saturate
+void float_to_8bit_scalar(const float* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   for( size_t k = 0; k < count; ++k ) {
+      float v = in[k];
+      if( rng ) {
+         uint32_t r = xorshift32(rng[0]);
+         v += ((int)(r & 0xffff) + (int)(r >> 16) - 65535) * (1.0f / 65536);
+      }
+      out[k] = (uint8_t)(int8_t)lrintf(std::fmin(std::fmax(v, -128.0f), 127.0f)) ^ flip;
+   }
+}
+
+// cs16 -> cs8, or cu8 with flip 0x80: add half an output LSB (plus
+// optional TPDF dither) with saturation, then keep the top byte
+void int16_to_8bit_scalar(const int16_t* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   for( size_t k = 0; k < count; ++k ) {
+      int v = in[k] + 128;
+      if( rng ) {
+         uint32_t r = xorshift32(rng[0]);
+         v += (int)(r & 0xff) + (int)((r >> 8) & 0xff) - 255;
+      }
+      v = std::min(std::max(v, -32768), 32767);
+      out[k] = (uint8_t)(int8_t)(v >> 8) ^ flip;
+   }
+}
+
+#ifdef SAMPLE_CONVERT_X86
+
+// cvtps2dq rounds to nearest in the default MXCSR mode, matching lrintf
+
+__attribute__((target("sse2")))
+void int16_to_float_sse2(const int16_t* in, float* out, size_t count)
+{
+   size_t i = 0;
+   for( ; i + 8 <= count; i += 8 ) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+      // widen with sign by parking each value in the top half of an int32
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      _mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+      _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+   }
+   int16_to_float_scalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void float_to_int16_sse2(const float* in, int16_t* out, size_t count)
+{
+   // clamp first: cvtps2dq turns out-of-range values into INT_MIN, which
+   // the saturating pack would then send the wrong way
+   const __m128 lo = _mm_set1_ps(Int16Min);
+   const __m128 hi = _mm_set1_ps(Int16Max);
+   size_t i = 0;
+   for( ; i + 8 <= count; i += 8 ) {
+      __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi));
+      __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi));
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+   }
+   float_to_int16_scalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void int32_to_float_sse2(const int32_t* in, float* out, size_t count)
+{
+   size_t i = 0;
+   for( ; i + 4 <= count; i += 4 ) {
+      _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i))));
+   }
+   int32_to_float_scalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void float_to_int32_sse2(const float* in, int32_t* out, size_t count)
+{
+   const __m128 lo = _mm_set1_ps(Int32Min);
+   const __m128 hi = _mm_set1_ps(Int32Max);
+   size_t i = 0;
+   for( ; i + 4 <= count; i += 4 ) {
+      __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi);
+      _mm_storeu_si128((__m128i*)(out + i), _mm_cvtps_epi32(v));
+   }
+   float_to_int32_scalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void int16_to_float_avx2(const int16_t* in, float* out, size_t count)
+{
+   size_t i = 0;
+   for( ; i + 16 <= count; i += 16 ) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 8));
+      _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)));
+      _mm256_storeu_ps(out + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)));
+   }
+   int16_to_float_sse2(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void float_to_int16_avx2(const float* in, int16_t* out, size_t count)
+{
+   const __m256 lo = _mm256_set1_ps(Int16Min);
+   const __m256 hi = _mm256_set1_ps(Int16Max);
+   size_t i = 0;
+   for( ; i + 16 <= count; i += 16 ) {
+      __m256i a = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), lo), hi));
+      __m256i b = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), lo), hi));
+      // the pack works per 128-bit lane; put the quarters back in order
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+      _mm256_storeu_si256((__m256i*)(out + i), packed);
+   }
+   float_to_int16_sse2(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void int32_to_float_avx2(const int32_t* in, float* out, size_t count)
+{
+   size_t i = 0;
+   for( ; i + 8 <= count; i += 8 ) {
+      _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(in + i))));
+   }
+   int32_to_float_sse2(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void float_to_int32_avx2(const float* in, int32_t* out, size_t count)
+{
+   const __m256 lo = _mm256_set1_ps(Int32Min);
+   const __m256 hi = _mm256_set1_ps(Int32Max);
+   size_t i = 0;
+   for( ; i + 8 <= count; i += 8 ) {
+      __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), lo), hi);
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_cvtps_epi32(v));
+   }
+   float_to_int32_sse2(in + i, out + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void uint8_to_float_sse2(const uint8_t* in, float* out, size_t count, float scale)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i bias = _mm_set1_epi16(128);
+   const __m128 vscale = _mm_set1_ps(scale);
+   size_t i = 0;
+   for( ; i + 16 <= count; i += 16 ) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+      // widen to int16 and centre there, where it is still exact
+      __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias);
+      __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias);
+      __m128i w[4] = { _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16),
+                       _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16),
+                       _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16),
+                       _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16) };
+      for( int k = 0; k < 4; ++k ) {
+         _mm_storeu_ps(out + i + k * 4, _mm_mul_ps(_mm_cvtepi32_ps(w[k]), vscale));
+      }
+   }
+   uint8_to_float_scalar(in + i, out + i, count - i, scale);
+}
+
+__attribute__((target("avx2")))
+void uint8_to_float_avx2(const uint8_t* in, float* out, size_t count, float scale)
+{
+   const __m256i bias = _mm256_set1_epi32(128);
+   const __m256 vscale = _mm256_set1_ps(scale);
+   size_t i = 0;
+   for( ; i + 16 <= count; i += 16 ) {
+      __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+      __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i + 8)));
+      _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(a, bias)), vscale));
+      _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(b, bias)), vscale));
+   }
+   uint8_to_float_sse2(in + i, out + i, count - i, scale);
+}
+
+// one xorshift32 step per lane, and TPDF noise in (-1, 1) from the sum
+// of each lane's two 16-bit halves
+
+__attribute__((target("sse2")))
+inline __m128i xorshift_sse2(__m128i s)
+{
+   s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+   s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+   return _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+}
+
+__attribute__((target("sse2")))
+inline __m128 tpdf_sse2(__m128i& state)
+{
+   state = xorshift_sse2(state);
+   __m128i sum = _mm_add_epi32(_mm_and_si128(state, _mm_set1_epi32(0xffff)), _mm_srli_epi32(state, 16));
+   return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(sum, _mm_set1_epi32(65535))), _mm_set1_ps(1.0f / 65536));
+}
+
+__attribute__((target("avx2")))
+inline __m256i xorshift_avx2(__m256i s)
+{
+   s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+   s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+   return _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+}
+
+__attribute__((target("avx2")))
+inline __m256 tpdf_avx2(__m256i& state)
+{
+   state = xorshift_avx2(state);
+   __m256i sum = _mm256_add_epi32(_mm256_and_si256(state, _mm256_set1_epi32(0xffff)), _mm256_srli_epi32(state, 16));
+   return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(sum, _mm256_set1_epi32(65535))), _mm256_set1_ps(1.0f / 65536));
+}
+
+__attribute__((target("sse2")))
+void float_to_8bit_sse2(const float* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   const __m128 lo = _mm_set1_ps(-128.0f);
+   const __m128 hi = _mm_set1_ps(127.0f);
+   const __m128i vflip = _mm_set1_epi8((char)flip);
+   __m128i state = rng ? _mm_loadu_si128((const __m128i*)rng) : _mm_setzero_si128();
+   size_t k = 0;
+   for( ; k + 16 <= count; k += 16 ) {
+      __m128i w[4];
+      for( int j = 0; j < 4; ++j ) {
+         __m128 v = _mm_loadu_ps(in + k + j * 4);
+         if( rng ) {
+            v = _mm_add_ps(v, tpdf_sse2(state));
+         }
+         w[j] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+      }
+      __m128i packed = _mm_packs_epi16(_mm_packs_epi32(w[0], w[1]), _mm_packs_epi32(w[2], w[3]));
+      _mm_storeu_si128((__m128i*)(out + k), _mm_xor_si128(packed, vflip));
+   }
+   if( rng ) {
+      _mm_storeu_si128((__m128i*)rng, state);
+   }
+   float_to_8bit_scalar(in + k, out + k, count - k, flip, rng);
+}
+
+__attribute__((target("avx2")))
+void float_to_8bit_avx2(const float* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   const __m256 lo = _mm256_set1_ps(-128.0f);
+   const __m256 hi = _mm256_set1_ps(127.0f);
+   const __m256i vflip = _mm256_set1_epi8((char)flip);
+   // undoes the per-lane interleave of the two packs
+   const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+   __m256i state = rng ? _mm256_loadu_si256((const __m256i*)rng) : _mm256_setzero_si256();
+   size_t k = 0;
+   for( ; k + 32 <= count; k += 32 ) {
+      __m256i w[4];
+      for( int j = 0; j < 4; ++j ) {
+         __m256 v = _mm256_loadu_ps(in + k + j * 8);
+         if( rng ) {
+            v = _mm256_add_ps(v, tpdf_avx2(state));
+         }
+         w[j] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+      }
+      __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(w[0], w[1]), _mm256_packs_epi32(w[2], w[3]));
+      packed = _mm256_permutevar8x32_epi32(packed, order);
+      _mm256_storeu_si256((__m256i*)(out + k), _mm256_xor_si256(packed, vflip));
+   }
+   if( rng ) {
+      _mm256_storeu_si256((__m256i*)rng, state);
+   }
+   float_to_8bit_sse2(in + k, out + k, count - k, flip, rng);
+}
+
+// half an output LSB, plus TPDF dither in [-255, 255] built from the two
+// bytes of each 16-bit lane of state when dithering
+__attribute__((target("sse2")))
+inline __m128i narrow_offset_sse2(__m128i state)
+{
+   const __m128i low_byte = _mm_set1_epi16(0xff);
+   __m128i sum = _mm_add_epi16(_mm_and_si128(state, low_byte), _mm_srli_epi16(state, 8));
+   return _mm_sub_epi16(sum, _mm_set1_epi16(255 - 128));
+}
+
+__attribute__((target("avx2")))
+inline __m256i narrow_offset_avx2(__m256i state)
+{
+   const __m256i low_byte = _mm256_set1_epi16(0xff);
+   __m256i sum = _mm256_add_epi16(_mm256_and_si256(state, low_byte), _mm256_srli_epi16(state, 8));
+   return _mm256_sub_epi16(sum, _mm256_set1_epi16(255 - 128));
+}
+
+__attribute__((target("sse2")))
+void int16_to_8bit_sse2(const int16_t* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   const __m128i vflip = _mm_set1_epi8((char)flip);
+   __m128i offset0 = _mm_set1_epi16(128);
+   __m128i offset1 = offset0;
+   __m128i state = rng ? _mm_loadu_si128((const __m128i*)rng) : _mm_setzero_si128();
+   size_t k = 0;
+   for( ; k + 16 <= count; k += 16 ) {
+      if( rng ) {
+         state = xorshift_sse2(state);
+         offset0 = narrow_offset_sse2(state);
+         state = xorshift_sse2(state);
+         offset1 = narrow_offset_sse2(state);
+      }
+      __m128i a = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128((const __m128i*)(in + k)), offset0), 8);
+      __m128i b = _mm_srai_epi16(_mm_adds_epi16(_mm_loadu_si128((const __m128i*)(in + k + 8)), offset1), 8);
+      _mm_storeu_si128((__m128i*)(out + k), _mm_xor_si128(_mm_packs_epi16(a, b), vflip));
+   }
+   if( rng ) {
+      _mm_storeu_si128((__m128i*)rng, state);
+   }
+   int16_to_8bit_scalar(in + k, out + k, count - k, flip, rng);
+}
+
+__attribute__((target("avx2")))
+void int16_to_8bit_avx2(const int16_t* in, uint8_t* out, size_t count, uint8_t flip, uint32_t* rng)
+{
+   const __m256i vflip = _mm256_set1_epi8((char)flip);
+   __m256i offset0 = _mm256_set1_epi16(128);
+   __m256i offset1 = offset0;
+   __m256i state = rng ? _mm256_loadu_si256((const __m256i*)rng) : _mm256_setzero_si256();
+   size_t k = 0;
+   for( ; k + 32 <= count; k += 32 ) {
+      if( rng ) {
+         state = xorshift_avx2(state);
+         offset0 = narrow_offset_avx2(state);
+         state = xorshift_avx2(state);
+         offset1 = narrow_offset_avx2(state);
+      }
+      __m256i a = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_loadu_si256((const __m256i*)(in + k)), offset0), 8);
+      __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_loadu_si256((const __m256i*)(in + k + 16)), offset1), 8);
+      // the pack interleaves a and b per 128-bit lane; restore the order
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8);
+      _mm256_storeu_si256((__m256i*)(out + k), _mm256_xor_si256(packed, vflip));
+   }
+   if( rng ) {
+      _mm256_storeu_si256((__m256i*)rng, state);
+   }
+   int16_to_8bit_sse2(in + k, out + k, count - k, flip, rng);
+}
+
+#define CONVERT_VARIANTS(name) name##_avx2, name##_sse2, name##_scalar
+
+#else
+
+#define CONVERT_VARIANTS(name) NULL, NULL, name##_scalar
+
+#endif
+
+template <class Fn>
+Fn select_variant(Fn avx2, Fn sse2, Fn scalar)
+{
+#ifdef SAMPLE_CONVERT_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return avx2;
+   }
+   if( __builtin_cpu_supports("sse2") ) {
+      return sse2;
+   }
+   return scalar;
+#else
+   (void)avx2;
+   (void)sse2;
+   return scalar;
+#endif
+}
+
+typedef void (*unpack_int24_fn)(const uint8_t*, int32_t*, size_t);
+typedef void (*int16_to_float_fn)(const int16_t*, float*, size_t);
+typedef void (*float_to_int16_fn)(const float*, int16_t*, size_t);
+typedef void (*int32_to_float_fn)(const int32_t*, float*, size_t);
+typedef void (*float_to_int32_fn)(const float*, int32_t*, size_t);
+typedef void (*uint8_to_float_fn)(const uint8_t*, float*, size_t, float);
+typedef void (*to_8bit_fn)(const float*, uint8_t*, size_t, uint8_t, uint32_t*);
+typedef void (*narrow_8bit_fn)(const int16_t*, uint8_t*, size_t, uint8_t, uint32_t*);
+
+unpack_int24_fn select_unpack_int24()
+{
+#ifdef SAMPLE_CONVERT_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx2") ) {
+      return unpack_int24_avx2;
+   }
+   if( __builtin_cpu_supports("ssse3") ) {
+      return unpack_int24_ssse3;
+   }
+#endif
+   return unpack_int24_scalar;
+}
+
+} // namespace
+
+void unpack_int24(const uint8_t* in, int32_t* out, size_t count)
+{
+   static const unpack_int24_fn impl = select_unpack_int24();
+   impl(in, out, count);
+}
+
+void int16_to_float(const int16_t* in, float* out, size_t count)
+{
+   static const int16_to_float_fn impl = select_variant<int16_to_float_fn>(
+      CONVERT_VARIANTS(int16_to_float));
+   impl(in, out, count);
+}
+
+void float_to_int16(const float* in, int16_t* out, size_t count)
+{
+   static const float_to_int16_fn impl = select_variant<float_to_int16_fn>(
+      CONVERT_VARIANTS(float_to_int16));
+   impl(in, out, count);
+}
+
+void int32_to_float(const int32_t* in, float* out, size_t count)
+{
+   static const int32_to_float_fn impl = select_variant<int32_to_float_fn>(
+      CONVERT_VARIANTS(int32_to_float));
+   impl(in, out, count);
+}
+
+void float_to_int32(const float* in, int32_t* out, size_t count)
+{
+   static const float_to_int32_fn impl = select_variant<float_to_int32_fn>(
+      CONVERT_VARIANTS(float_to_int32));
+   impl(in, out, count);
+}
+
+void uint8_to_float(const uint8_t* in, float* out, size_t count, float scale)
+{
+   static const uint8_to_float_fn impl = select_variant<uint8_to_float_fn>(
+      CONVERT_VARIANTS(uint8_to_float));
+   impl(in, out, count, scale);
+}
+
+void float_to_uint8(const float* in, uint8_t* out, size_t count, uint32_t* dither_state)
+{
+   static const to_8bit_fn impl = select_variant<to_8bit_fn>(
+      CONVERT_VARIANTS(float_to_8bit));
+   impl(in, out, count, 0x80, dither_state);
+}
+
+void float_to_int8(const float* in, int8_t* out, size_t count, uint32_t* dither_state)
+{
+   static const to_8bit_fn impl = select_variant<to_8bit_fn>(
+      CONVERT_VARIANTS(float_to_8bit));
+   impl(in, (uint8_t*)out, count, 0, dither_state);
+}
+
+void int16_to_uint8(const int16_t* in, uint8_t* out, size_t count, uint32_t* dither_state)
+{
+   static const narrow_8bit_fn impl = select_variant<narrow_8bit_fn>(
+      CONVERT_VARIANTS(int16_to_8bit));
+   impl(in, out, count, 0x80, dither_state);
+}
+
+void int16_to_int8(const int16_t* in, int8_t* out, size_t count, uint32_t* dither_state)
+{
+   static const narrow_8bit_fn impl = select_variant<narrow_8bit_fn>(
+      CONVERT_VARIANTS(int16_to_8bit));
+   impl(in, (uint8_t*)out, count, 0, dither_state);
+}
@@ -0,0 +1,41 @@
+/*
+ * Sample format conversion kernels.
+ *
+ * Each kernel has a scalar version plus SSSE3/AVX2 versions on x86 that
+ * are picked at run time from what the CPU supports, so the binary still
+ * runs on machines (and architectures) without them.
+ */
+#ifndef SAMPLE_CONVERT_H
+#define SAMPLE_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Unpack count packed little-endian 24-bit values into int32. Each value
+// lands in the top 24 bits (i.e. sign-extended and scaled by 256), so the
+// result is full-scale cs32 that int32 consumers treat correctly.
+void unpack_int24(const uint8_t* in, int32_t* out, size_t count);
+
+// Convert count integer values to float and back. The float side keeps
+// the integer scale (no normalisation to +-1.0); the way back rounds to
+// nearest and saturates at the integer type's limits.
+void int16_to_float(const int16_t* in, float* out, size_t count);
+void float_to_int16(const float* in, int16_t* out, size_t count);
+void int32_to_float(const int32_t* in, float* out, size_t count);
+void float_to_int32(const float* in, int32_t* out, size_t count);
+
+// cu8 is offset binary centred on 128. The float side is centred on zero
+// and multiplied by scale on the way in, so one pass gives cu8 scale
+// (1), cs16 scale (256) or +-1.0 (1/128).
+void uint8_to_float(const uint8_t* in, float* out, size_t count, float scale);
+
+// Float at 8-bit scale to cu8 or cs8, and cs16 narrowed to its top byte
+// without going through float. Both round and saturate; given
+// dither_state (8 words of xorshift32 state, carried from call to call)
+// they add TPDF dither of +-1 output LSB first.
+void float_to_uint8(const float* in, uint8_t* out, size_t count, uint32_t* dither_state = NULL);
+void float_to_int8(const float* in, int8_t* out, size_t count, uint32_t* dither_state = NULL);
+void int16_to_uint8(const int16_t* in, uint8_t* out, size_t count, uint32_t* dither_state = NULL);
+void int16_to_int8(const int16_t* in, int8_t* out, size_t count, uint32_t* dither_state = NULL);
+
+#endif /* SAMPLE_CONVERT_H */
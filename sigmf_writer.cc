@@ -0,0 +1,175 @@
+/*
+ * SigMF metadata for IQ recordings.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "sigmf_writer.h"
+
+static const char* const SigMFVersion = "1.0.0";
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+   return s.size() >= suffix.size() &&
+          0 == s.compare(s.size() - suffix.size(), suffix.size(), suffix);
+}
+
+// JSON string literal, quotes included
+static std::string quoted(const std::string& s)
+{
+   std::string out = "\"";
+   for( char c : s ) {
+      switch( c ) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+         if( (unsigned char)c < 0x20 ) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+         } else {
+            out += c;
+         }
+      }
+   }
+   return out + "\"";
+}
+
+static const char* device_name(uint32_t type)
+{
+   switch( type ) {
+   case DEVICE_AIRSPY_ONE: return "Airspy One";
+   case DEVICE_AIRSPY_HF:  return "Airspy HF+";
+   case DEVICE_RTLSDR:     return "RTL-SDR";
+   default:                return "unknown device";
+   }
+}
+
+// ISO 8601 UTC with microseconds, as core:datetime wants it
+static std::string iso8601(std::chrono::system_clock::time_point t)
+{
+   int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+   time_t secs = us / 1000000;
+   struct tm tm;
+   gmtime_r(&secs, &tm);
+   char buf[40];
+   size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+   snprintf(buf + n, sizeof(buf) - n, ".%06dZ", (int)(us % 1000000));
+   return buf;
+}
+
+sigmf_meta::sigmf_meta(const std::string& base) :
+   m_data_filename(base_name(base) + ".sigmf-data"),
+   m_meta_filename(base_name(base) + ".sigmf-meta"),
+   m_sample_rate(0),
+   m_frequency(0),
+   m_device(),
+   m_sync(),
+   m_have_device(false),
+   m_start(std::chrono::system_clock::now())
+{
+}
+
+std::string sigmf_meta::base_name(const std::string& filename)
+{
+   static const char* const suffixes[] = { ".sigmf-data", ".sigmf-meta", ".sigmf" };
+   for( const char* suffix : suffixes ) {
+      if( ends_with(filename, suffix) ) {
+         return filename.substr(0, filename.size() - strlen(suffix));
+      }
+   }
+   return filename;
+}
+
+void sigmf_meta::set_device(const DeviceInfo& info, const ClientSync& sync)
+{
+   m_device = info;
+   m_sync = sync;
+   m_have_device = true;
+}
+
+void sigmf_meta::add_annotation(uint64_t sample_start, uint64_t sample_count, uint64_t lost_samples,
+                                const std::string& comment)
+{
+   m_annotations.push_back({ sample_start, sample_count, lost_samples, comment });
+}
+
+void sigmf_meta::truncate(uint64_t sample_count)
+{
+   while( !m_annotations.empty() && m_annotations.back().sample_start >= sample_count ) {
+      m_annotations.pop_back();
+   }
+}
+
+void sigmf_meta::write() const
+{
+   std::ostringstream js;
+   js << std::setprecision(15);
+
+   js << "{\n  \"global\": {\n"
+      << "    \"core:datatype\": " << quoted(m_datatype) << ",\n"
+      << "    \"core:sample_rate\": " << m_sample_rate << ",\n"
+      << "    \"core:version\": " << quoted(SigMFVersion) << ",\n"
+      << "    \"core:recorder\": \"ss_client\",\n";
+   if( !m_description.empty() ) {
+      js << "    \"core:description\": " << quoted(m_description) << ",\n";
+   }
+   if( m_have_device ) {
+      char serial[16];
+      snprintf(serial, sizeof(serial), "%08X", m_device.DeviceSerial);
+      js << "    \"core:hw\": " << quoted(std::string(device_name(m_device.DeviceType)) + " via SpyServer") << ",\n"
+         << "    \"spyserver:device_type\": " << m_device.DeviceType << ",\n"
+         << "    \"spyserver:device_serial\": " << quoted(serial) << ",\n"
+         << "    \"spyserver:maximum_sample_rate\": " << m_device.MaximumSampleRate << ",\n"
+         << "    \"spyserver:gain\": " << m_sync.Gain << ",\n"
+         << "    \"spyserver:device_center_frequency\": " << m_sync.DeviceCenterFrequency << ",\n";
+   }
+   js << "    \"core:extensions\": [\n"
+      << "      { \"name\": \"spyserver\", \"version\": \"1.0.0\", \"optional\": true }\n"
+      << "    ]\n  },\n";
+
+   js << "  \"captures\": [\n    {\n"
+      << "      \"core:sample_start\": 0,\n";
+   if( m_frequency != 0 ) {
+      js << "      \"core:frequency\": " << m_frequency << ",\n";
+   } else if( m_have_device ) {
+      js << "      \"core:frequency\": " << m_sync.IQCenterFrequency << ",\n";
+   }
+   js << "      \"core:datetime\": " << quoted(iso8601(m_start)) << "\n"
+      << "    }\n  ],\n";
+
+   js << "  \"annotations\": [";
+   for( size_t i = 0; i < m_annotations.size(); ++i ) {
+      const annotation& a = m_annotations[i];
+      js << (i ? ",\n" : "\n")
+         << "    { \"core:sample_start\": " << a.sample_start
+         << ", \"core:sample_count\": " << a.sample_count
+         << ", \"spyserver:lost_samples\": " << a.lost_samples
+         << ", \"core:comment\": " << quoted(a.comment) << " }";
+   }
+   js << (m_annotations.empty() ? "]\n}\n" : "\n  ]\n}\n");
+
+   std::string tmp = m_meta_filename + ".tmp";
+   {
+      std::ofstream out(tmp, std::ofstream::binary | std::ofstream::trunc);
+      out << js.str();
+      out.close();
+      if( !out ) {
+         throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                   "Failed to write " + tmp + ": " + strerror(errno) );
+      }
+   }
+   if( 0 != rename(tmp.c_str(), m_meta_filename.c_str()) ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Failed to rename " + tmp + ": " + strerror(errno) );
+   }
+}
@@ -0,0 +1,87 @@
+/*
+ * SigMF metadata for IQ recordings.
+ *
+ * A recording is <base>.sigmf-data, the raw samples, plus <base>.sigmf-meta,
+ * the JSON description written here: one global object, one capture
+ * segment covering the whole file and an annotation wherever samples are
+ * missing from the data file. The missing samples aren't in the file, so
+ * an annotation covers the samples either side of the join that it spoils
+ * (one, or a filter's length when the samples were filtered) and says how
+ * many went missing in spyserver:lost_samples. The metadata is kept in
+ * memory and write() replaces the .sigmf-meta file atomically (temporary
+ * file + rename), so it can be written once when the capture starts and
+ * again when it ends without a reader ever seeing half a file.
+ *
+ * Fields that SigMF has no core key for (gain index, device serial, ...)
+ * go in a "spyserver" extension namespace.
+ */
+#ifndef SIGMF_WRITER_H
+#define SIGMF_WRITER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "spyserver_protocol.h"
+
+class sigmf_meta {
+public:
+   // base is the recording name without an extension; a trailing
+   // .sigmf-data, .sigmf-meta or .sigmf is stripped
+   explicit sigmf_meta(const std::string& base);
+
+   static std::string base_name(const std::string& filename);
+
+   const std::string& data_filename() const { return m_data_filename; }
+   const std::string& meta_filename() const { return m_meta_filename; }
+
+   // core:datatype for the sample format written, e.g. "ci16_le"
+   void set_datatype(const std::string& datatype) { m_datatype = datatype; }
+   void set_sample_rate(double sample_rate) { m_sample_rate = sample_rate; }
+   void set_description(const std::string& description) { m_description = description; }
+
+   // hardware and tuning as reported by the server at capture time
+   void set_device(const DeviceInfo& info, const ClientSync& sync);
+
+   void set_capture_start(std::chrono::system_clock::time_point start) { m_start = start; }
+
+   // core:frequency of the capture when it is not the server's IQ centre,
+   // e.g. one channel of a chan mode split
+   void set_frequency(double frequency) { m_frequency = frequency; }
+
+   // annotations must be added in sample order; lost_samples is how many
+   // samples are missing just before sample_start
+   void add_annotation(uint64_t sample_start, uint64_t sample_count, uint64_t lost_samples,
+                       const std::string& comment);
+
+   // drop annotations that start at or after sample_count, for when the
+   // recording stopped before reaching them
+   void truncate(uint64_t sample_count);
+
+   size_t annotations() const { return m_annotations.size(); }
+
+   void write() const;
+
+private:
+   struct annotation {
+      uint64_t sample_start;
+      uint64_t sample_count;
+      uint64_t lost_samples;
+      std::string comment;
+   };
+
+   std::string m_data_filename;
+   std::string m_meta_filename;
+   std::string m_datatype;
+   std::string m_description;
+   double m_sample_rate;
+   double m_frequency;     // 0: the IQ centre from the client sync
+   DeviceInfo m_device;
+   ClientSync m_sync;
+   bool m_have_device;
+   std::chrono::system_clock::time_point m_start;
+   std::vector<annotation> m_annotations;
+};
+
+#endif
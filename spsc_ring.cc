@@ -0,0 +1,152 @@
+/*
+ * Lock-free single-producer / single-consumer byte ring.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+spsc_ring::spsc_ring(size_t size) :
+   m_head(0),
+   m_tail(0),
+   m_watermark(0),
+   m_wakeups(0),
+   m_dropped(0),
+   m_buf(NULL),
+   m_size(round_to_pages(size))
+{
+   int fd = memfd_create("ss_client_fifo", MFD_CLOEXEC);
+   if( fd < 0 ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "memfd_create failed: " + std::to_string(errno) );
+   }
+   if( ftruncate(fd, m_size) < 0 ) {
+      close(fd);
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "ftruncate failed: " + std::to_string(errno) );
+   }
+
+   // reserve 2 * size of address space, then map the same pages into both halves
+   void* base = mmap(NULL, 2 * m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if( MAP_FAILED == base ) {
+      close(fd);
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "mmap reserve failed: " + std::to_string(errno) );
+   }
+
+   uint8_t* lo = (uint8_t*)base;
+   void* first = mmap(lo, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+   void* second = mmap(lo + m_size, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+   int err = errno;
+   close(fd); // the mappings keep the memory alive
+
+   if( first != lo || second != lo + m_size ) {
+      munmap(base, 2 * m_size);
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "mmap of ring halves failed: " + std::to_string(err) );
+   }
+
+   m_buf = lo;
+}
+
+spsc_ring::~spsc_ring()
+{
+   if( m_buf ) {
+      munmap(m_buf, 2 * m_size);
+      m_buf = NULL;
+   }
+}
+
+size_t spsc_ring::round_to_pages(size_t size)
+{
+   size_t page = sysconf(_SC_PAGESIZE);
+   if( size == 0 ) {
+      size = page;
+   }
+   return ((size + page - 1) / page) * page;
+}
+
+bool spsc_ring::write(const uint8_t* data, size_t len)
+{
+   uint8_t* dst = reserve(len);
+   if( !dst ) {
+      return false;
+   }
+   memcpy(dst, data, len);
+   commit(len);
+   return true;
+}
+
+uint8_t* spsc_ring::reserve(size_t len)
+{
+   uint64_t head = m_head.load(std::memory_order_relaxed);
+   uint64_t tail = m_tail.load(std::memory_order_acquire);
+
+   if( m_size - (head - tail) < len ) {
+      m_dropped.fetch_add(len, std::memory_order_relaxed);
+      return NULL;
+   }
+
+   // no wrap case: the second mapping catches anything past m_size
+   return m_buf + (head % m_size);
+}
+
+void spsc_ring::commit(size_t len)
+{
+   uint64_t head = m_head.load(std::memory_order_relaxed) + len;
+
+   // seq_cst so the watermark load below cannot be ordered before it;
+   // pairs with the store in wait_for_data()
+   m_head.store(head, std::memory_order_seq_cst);
+   notify_consumer(head);
+}
+
+void spsc_ring::notify_consumer(uint64_t head)
+{
+   uint64_t watermark = m_watermark.load(std::memory_order_seq_cst);
+   if( 0 == watermark ) {
+      return;
+   }
+   if( head - m_tail.load(std::memory_order_acquire) >= watermark ) {
+      {
+         std::lock_guard<std::mutex> lock(m_wait_lock);
+         m_watermark.store(0, std::memory_order_relaxed);
+      }
+      m_wait_cv.notify_one();
+      m_wakeups.fetch_add(1, std::memory_order_relaxed);
+   }
+}
+
+size_t spsc_ring::read(uint8_t* dst, size_t len)
+{
+   uint64_t tail = m_tail.load(std::memory_order_relaxed);
+   uint64_t head = m_head.load(std::memory_order_acquire);
+
+   len = std::min(len, (size_t)(head - tail));
+   memcpy(dst, m_buf + (tail % m_size), len);
+
+   m_tail.store(tail + len, std::memory_order_release);
+   return len;
+}
+
+bool spsc_ring::wait_for_data(size_t bytes, std::chrono::milliseconds timeout)
+{
+   if( used() >= bytes ) {
+      return true;
+   }
+
+   std::unique_lock<std::mutex> lock(m_wait_lock);
+   m_watermark.store(bytes, std::memory_order_seq_cst);
+   bool ready = m_wait_cv.wait_for(lock, timeout, [&] {
+      return m_head.load(std::memory_order_seq_cst) - m_tail.load(std::memory_order_relaxed) >= bytes;
+   });
+   m_watermark.store(0, std::memory_order_relaxed);
+   return ready;
+}
@@ -0,0 +1,129 @@
+/*
+ * Lock-free single-producer / single-consumer byte ring.
+ *
+ * The producer only ever advances m_head and the consumer only ever
+ * advances m_tail; both are free-running byte counters kept on separate
+ * cache lines, so neither side takes a lock to move data.
+ *
+ * A consumer that needs more data than is queued registers a watermark
+ * and sleeps on a condition variable. The producer looks at the watermark
+ * after publishing and only touches the mutex when a sleeping consumer's
+ * watermark has been reached, so frames arriving while the consumer is
+ * busy cost nothing beyond the atomic stores.
+ *
+ * The storage is a memfd mapped twice back to back, so the bytes at
+ * [size, 2*size) alias [0, size). Any run of up to size bytes starting
+ * anywhere in the ring is therefore contiguous in memory: writes are a
+ * single memcpy and consumers can work directly on the ring through
+ * read_ptr()/consume() without ever seeing a wrap.
+ */
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+class spsc_ring {
+public:
+   static constexpr size_t CacheLine = 64;
+
+   // size is rounded up to a multiple of the page size
+   explicit spsc_ring(size_t size);
+   ~spsc_ring();
+
+   spsc_ring(const spsc_ring&) = delete;
+   spsc_ring& operator=(const spsc_ring&) = delete;
+
+   size_t size() const { return m_size; }
+   size_t used() const {
+      return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+   }
+   size_t free_space() const { return m_size - used(); }
+   // Free-running byte counts; head() - tail() == used()
+   uint64_t head() const { return m_head.load(std::memory_order_acquire); }
+   uint64_t tail() const { return m_tail.load(std::memory_order_acquire); }
+
+   // Producer side. Writes all of len or nothing; returns false on overflow.
+   bool write(const uint8_t* data, size_t len);
+
+   // Producer side, zero copy. reserve() returns room for len contiguous
+   // bytes, or NULL (counting them as dropped) if the ring is too full;
+   // fill it in and publish with commit(len).
+   uint8_t* reserve(size_t len);
+   void commit(size_t len);
+
+   // Consumer side. Copies out up to len bytes and returns the count.
+   size_t read(uint8_t* dst, size_t len);
+
+   // Consumer side, zero copy. Returns a pointer to the oldest queued byte;
+   // all used() bytes following it are contiguous. consume() releases them.
+   const uint8_t* read_ptr() const { return m_buf + (m_tail.load(std::memory_order_relaxed) % m_size); }
+   void consume(size_t len) { m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+
+   // Consumer side. Sleeps until at least bytes are queued or timeout
+   // expires; returns whether the data is there.
+   bool wait_for_data(size_t bytes, std::chrono::milliseconds timeout);
+
+   // Number of times the producer had to wake a sleeping consumer
+   uint64_t wakeups() const { return m_wakeups.load(std::memory_order_relaxed); }
+   // Bytes discarded by write() because the ring was full
+   uint64_t dropped_bytes() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+   void notify_consumer(uint64_t head);
+   static size_t round_to_pages(size_t size);
+
+   alignas(CacheLine) std::atomic<uint64_t> m_head;
+   alignas(CacheLine) std::atomic<uint64_t> m_tail;
+   // bytes the sleeping consumer is waiting for; 0 when nobody is waiting
+   alignas(CacheLine) std::atomic<uint64_t> m_watermark;
+   std::atomic<uint64_t> m_wakeups;
+   std::atomic<uint64_t> m_dropped;
+
+   alignas(CacheLine) uint8_t* m_buf; // 2 * m_size bytes of address space
+   const size_t m_size;
+
+   std::mutex m_wait_lock;
+   std::condition_variable m_wait_cv;
+};
+
+// Fixed-capacity single-producer / single-consumer queue of small records,
+// used to carry per-frame metadata alongside the byte ring.
+template <class T, size_t Capacity>
+class spsc_queue {
+   static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+   spsc_queue() : m_head(0), m_tail(0) {}
+
+   // Producer side; returns false (dropping item) when full.
+   bool push(const T& item) {
+      uint64_t head = m_head.load(std::memory_order_relaxed);
+      if( head - m_tail.load(std::memory_order_acquire) == Capacity ) {
+         return false;
+      }
+      m_items[head & (Capacity - 1)] = item;
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Consumer side; oldest item or NULL when empty. pop() discards it.
+   const T* front() const {
+      uint64_t tail = m_tail.load(std::memory_order_relaxed);
+      if( tail == m_head.load(std::memory_order_acquire) ) {
+         return NULL;
+      }
+      return &m_items[tail & (Capacity - 1)];
+   }
+   void pop() { m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+   alignas(spsc_ring::CacheLine) std::atomic<uint64_t> m_head;
+   alignas(spsc_ring::CacheLine) std::atomic<uint64_t> m_tail;
+   T m_items[Capacity];
+};
+
+#endif /* SPSC_RING_H */
@@ -2,13 +2,41 @@
 #include <iomanip> // setprecision
 #include <fstream>
 #include <string>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
 
 #include <getopt.h>
-
-#include <samplerate.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "tcp_client.h"
 #include "ss_client_if.h"
+#include "power_writer.h"
+#include "iq_writer.h"
+#include "sigmf_writer.h"
+#include "resampler.h"
+#include "iq_convert.h"
+#include "iq_spectrum.h"
+#include "channelizer.h"
+
+// size of each buffer queued to the iq output writer
+static const uint32_t WriterBufferSize = 1024 * 1024;
+
+// the FIFO's sample format for each -b setting
+iq_format native_format(uint8_t sample_bits) {
+   return sample_bits == 8 ? IQ_CU8 : sample_bits == 16 ? IQ_CS16 :
+          sample_bits == 24 ? IQ_CS32 : IQ_CF32;
+}
+
+// time constant of the -D DC removal
+static const double DcTimeConstantSeconds = 0.1;
+
+// the server caps its FFT at 32768 bins; -C is only limited by memory
+static const uint32_t MaxClientFftBins = 1 << 20;
+
+// upper limit for -t, the -C and chan worker threads
+static const long MaxWorkerThreads = 64;
 
 typedef struct settings {
    double low_freq;
@@ -29,44 +57,84 @@ typedef struct settings {
    uint8_t do_fft;
    uint8_t oneshot;
    uint8_t sample_bits;
+   uint8_t fft_bits;
+   bool fft_linear;
+   bool client_fft;
+   iq_spectrum::window fft_window;
+   double fft_overlap;
+   uint32_t fft_threads;
+   double fft_resolution;
    uint32_t output_rate;
    uint32_t resample_quality;
    uint32_t batch_size;
+   uint32_t fifo_size;
+   uint32_t writer_backlog_mb;
+   bool writer_uring;
+   bool writer_vmsplice;
+   bool record_sigmf;
+   iq_format output_format;
+   bool output_format_set;
+   bool remove_dc;
+   bool dither;
+   uint8_t do_bench;
+   uint8_t do_chan;
+   std::vector<double> channel_freqs;
+   uint32_t low_latency_ms;
+   uint32_t sync_timeout_ms;
+   uint32_t fft_rotate_seconds;
+   power_writer::format fft_format;
    bool accept_mismatched_center;
    
 } SettingsT;
 
 
-/*
-enum
-      {    
-          SRC_SINC_BEST_QUALITY       = 0,
-          SRC_SINC_MEDIUM_QUALITY     = 1,
-          SRC_SINC_FASTEST            = 2,
-          SRC_ZERO_ORDER_HOLD         = 3,
-          SRC_LINEAR                  = 4
-      } ;
-*/
 void usage(char* appname) {
    
    static bool printed = false;
    
    if(!printed) {
       std::cout << "Usage: " << appname << " [-options] <mode> [iq_outfile] [fft_outfile]\n"
-                << "\n  mode: one of  iq | fft | both"
+                << "\n  mode: one of  iq | fft | both | chan | bench"
+                << "\n        chan splits one iq stream into the -K channels at -s each, written to the iq outfile"
+                << "\n        name with _<channel Hz> inserted before its extension"
+                << "\n        bench times iq outfile writes at several -a batch sizes; no server needed"
                 << "\n  -f <center frequency> or <low_hz:high_hz:fft_res>"
                 << "\n  -s <sample_rate>"
                 << "\n  [-a <data batch size, default 32768, shorter dumps collected data more often>]"
-//                << "\n  [-b <bits>, '8' or '16', default 16; 8 is EXPERIMENTAL]"
+                << "\n  [-b <bits>, '8', '16', '24' (cs32 out) or '32' (cf32), default 16; 8 is EXPERIMENTAL]"
+                << "\n  [-B <fft bits>, '8' or '4' (half the spectrum bandwidth), default 8]"
                 << "\n  [-j <digital gain> - experimental, 0.0 .. 1.0]"
                 << "\n  [-e <fft resolution> default 100Hz target]"
                 << "\n  [-g <gain>]"
                 << "\n  [-i  <integration interval for fft data> (default: 10 seconds)]"
-                << "\n  [-l <resample quality, 0-4, 0=best, 2=fastest (default), 3=samp_hold, 4=linear>]"
+                << "\n  [-P] average fft bins as linear power and report dB, instead of averaging the server's dB values"
+                << "\n  [-C] compute the fft here from the iq stream instead of using the server's fft stream;"
+                << "\n        bins are averaged as linear power and reported in dB relative to full scale"
+                << "\n  [-w <rectangle|hann|hamming|blackman|blackman-harris>] -C window, default hann"
+                << "\n  [-v <percent>] -C frame overlap, 0 to 95, default 50"
+                << "\n  [-t <threads>] worker threads for -C transforms and the chan filterbank, default 2;"
+                << "\n        0 does the work on the iq thread"
+                << "\n  [-K <freq>[,<freq>...]] chan mode channel center frequencies, within the band around -f"
+                << "\n  [-m <raw|sigmf>] iq outfile format: bare samples (default) or a SigMF recording,"
+                << "\n        <iq outfile>.sigmf-data plus .sigmf-meta with lost or dropped samples annotated"
+                << "\n  [-L <ms>] low-latency mode: hand over partial batches after <ms> instead of waiting for a full one"
+                << "\n  [-l <resample quality, 0-4, 0=best, 1=medium, 2=fastest (default), 3=samp_hold, 4=linear>]"
                 << "\n  [-r <server>]"
+                << "\n  [-R <seconds>] start a new fft outfile every <seconds>, renaming the old one with its start time"
                 << "\n  [-q <port>]"
                 << "\n  [-n <num_samples>]"
+                << "\n  [-O <cu8|cs8|cs16|cs32|cf32>] iq outfile sample format, default the -b format"
+                << "\n  [-D] remove DC from the iq output"
+                << "\n  [-N] dither when the iq output is cs8 or cu8"
                 << "\n  [-o] accept mismatched center frequency from locked spyserver"
+                << "\n  [-T <ms>] how long to wait for device info / client sync replies, default 1000"
+                << "\n  [-S] vmsplice the iq output into a pipe instead of copying it; only safe if the reader"
+                << "\n        read()s it, not if it splices or tees the data on (pv, another pipe, zero-copy send)"
+                << "\n  [-U] write the iq outfile with io_uring and O_DIRECT, if available"
+                << "\n  [-W <csv|bin>] fft outfile format: rtl_power csv (default) or binary rows plus a .idx time index"
+                << "\n  [-z <sample FIFO size in bytes, default 10485760; rounded up to whole pages and to at least"
+                << "\n        two of the largest frames (1 MiB on the wire, 8/6 of that for -b 24) and two -a batches>]"
+                << "\n  [-Z <MB>] output writer backlog that absorbs disk or pipe stalls, default 64"
                 << "\n  [<iq outfile name>] ( '-' for stdout; optional, but must be specified if an fft outfilename is also provided)"
                 << "\n  [<fft outfile name>] default log_power.csv"
                 << std::endl
@@ -128,9 +196,30 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
    settings.fft_outfilename = strdup("log_power.csv");
    settings.oneshot = 0;
    settings.sample_bits = 16;
+   settings.fft_bits = 8;
+   settings.fft_linear = false;
+   settings.client_fft = false;
+   settings.fft_window = iq_spectrum::HANN;
+   settings.fft_overlap = 0.5;
+   settings.fft_threads = 2;
    settings.output_rate = 48000;
    settings.resample_quality = 2;
    settings.batch_size = 32768;
+   settings.fifo_size = 10 * 1024 * 1024;
+   settings.writer_backlog_mb = 64;
+   settings.writer_uring = false;
+   settings.writer_vmsplice = false;
+   settings.record_sigmf = false;
+   settings.output_format = IQ_CS16;
+   settings.output_format_set = false;
+   settings.remove_dc = false;
+   settings.dither = false;
+   settings.do_bench = 0;
+   settings.do_chan = 0;
+   settings.low_latency_ms = 0;
+   settings.sync_timeout_ms = 1000;
+   settings.fft_rotate_seconds = 0;
+   settings.fft_format = power_writer::CSV;
    settings.accept_mismatched_center = false;
    
    int opt;
@@ -138,15 +227,24 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
 
    // Need to accept rtl_power-style args.
    // Example: rtl_power -f 400400000:403500000:800 -i20 -1 -c 20% -p 0 -d 0 -g 26.0 log_power.csv
-   while ((opt = getopt(argc, argv, "a:b:c:d:e:f:F:g:i:j:M:n:p:q:r:s:h1o")) != -1) {
+   while ((opt = getopt(argc, argv, "a:b:B:c:Cd:De:f:F:g:i:j:K:l:L:m:M:n:NO:Pp:q:r:R:s:St:T:Uv:w:W:z:Z:h1o")) != -1) {
       switch (opt) {
       case 'a': // batch size
          settings.batch_size = atoi(optarg);
          break;
       case 'b': // sample_bits
          settings.sample_bits = atoi(optarg);
-         if( settings.sample_bits != 8 && settings.sample_bits != 16 ) {
-            std::cerr << "sample bits value " << optarg << " must be 8 or 16\n";
+         if( settings.sample_bits != 8 && settings.sample_bits != 16 &&
+             settings.sample_bits != 24 && settings.sample_bits != 32 ) {
+            std::cerr << "sample bits value " << optarg << " must be 8, 16, 24 or 32\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'B': // fft bits
+         settings.fft_bits = atoi(optarg);
+         if( settings.fft_bits != 8 && settings.fft_bits != 4 ) {
+            std::cerr << "fft bits value " << optarg << " must be 8 or 4\n";
             usage(argv[0]);
             exit(0);
          }
@@ -157,8 +255,14 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
       case 'c': // chop n% of edges - not supported
          std::cerr << "-c not currently supported; ignoring\n";
          break;
+      case 'C': // client side fft
+         settings.client_fft = true;
+         break;
       case 'd': // ignore device spec
          break;
+      case 'D': // DC removal
+         settings.remove_dc = true;
+         break;
       case 'e': // fft resolution
          fft_resolution = strtod(optarg, NULL);
          break;
@@ -178,8 +282,32 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
       case 'j': // digital gain
          settings.dig_gain = strtod(optarg, NULL);
          break;
-      case 'l': // digital gain
+      case 'K': // chan mode channels
+         for( char* f = strtok(optarg, ","); NULL != f; f = strtok(NULL, ",") ) {
+            settings.channel_freqs.push_back(strtod(f, NULL));
+         }
+         break;
+      case 'L': // low latency
+         settings.low_latency_ms = atoi(optarg);
+         break;
+      case 'l': // resample quality
          settings.resample_quality = atoi(optarg);
+         if( settings.resample_quality > poly_resampler::LINEAR ) {
+            std::cerr << "resample quality " << optarg << " must be 0 to 4\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'm': // iq outfile format
+         if( 0 == strcmp("raw", optarg) ) {
+            settings.record_sigmf = false;
+         } else if( 0 == strcmp("sigmf", optarg) ) {
+            settings.record_sigmf = true;
+         } else {
+            std::cerr << "iq outfile format " << optarg << " must be raw or sigmf\n";
+            usage(argv[0]);
+            exit(0);
+         }
          break;
       case 'M': // # ignore
          std::cerr << "-M not currently supported; ignoring\n";
@@ -187,9 +315,23 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
       case 'n': // # samples
 	      settings.samples = strtol(optarg, NULL, 0);
 	      break;
+      case 'O': // iq output sample format
+         settings.output_format_set = parse_iq_format(optarg, settings.output_format);
+         if( !settings.output_format_set ) {
+            std::cerr << "iq output format " << optarg << " must be cu8, cs8, cs16, cs32 or cf32\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'N': // dither
+         settings.dither = true;
+         break;
       case 'o': // fOrce accept mismatched centers
          settings.accept_mismatched_center = true;
 	      break;
+      case 'P': // linear power averaging
+         settings.fft_linear = true;
+         break;
       case 'p': // ppm error - not supported
          std::cerr << "-p not currently supported; ignoring\n";
 	      break;
@@ -199,10 +341,66 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
       case 'r': // seRveR
 	      settings.server = strdup(optarg);
 	      break;
+      case 'R': // rotate fft log
+         settings.fft_rotate_seconds = atoi(optarg);
+         break;
       case 's': // sampling rate
          settings.sample_rate = strtod(optarg, NULL);
          settings.output_rate = settings.sample_rate;
          break;
+      case 't': // client fft threads
+         {
+            char* end = NULL;
+            long threads = strtol(optarg, &end, 10);
+            if( end == optarg || *end != '\0' || threads < 0 || threads > MaxWorkerThreads ) {
+               std::cerr << "threads value " << optarg << " must be 0 to " << MaxWorkerThreads << "\n";
+               usage(argv[0]);
+               exit(0);
+            }
+            settings.fft_threads = threads;
+         }
+         break;
+      case 'T': // sync timeout
+         settings.sync_timeout_ms = atoi(optarg);
+         break;
+      case 'U': // io_uring output
+         settings.writer_uring = true;
+         break;
+      case 'S': // vmsplice output
+         settings.writer_vmsplice = true;
+         break;
+      case 'v': // client fft overlap
+         settings.fft_overlap = strtod(optarg, NULL) / 100.0;
+         if( !(settings.fft_overlap >= 0 && settings.fft_overlap <= 0.95) ) {
+            std::cerr << "fft overlap " << optarg << " must be 0 to 95 percent\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'w': // client fft window
+         if( !iq_spectrum::parse_window(optarg, settings.fft_window) ) {
+            std::cerr << "fft window " << optarg << " must be rectangle, hann, hamming, blackman or blackman-harris\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'W': // fft outfile format
+         if( 0 == strcmp("csv", optarg) ) {
+            settings.fft_format = power_writer::CSV;
+         } else if( 0 == strcmp("bin", optarg) ) {
+            settings.fft_format = power_writer::BINARY;
+         } else {
+            std::cerr << "fft outfile format " << optarg << " must be csv or bin\n";
+            usage(argv[0]);
+            exit(0);
+         }
+         break;
+      case 'z': // sample fifo size
+         settings.fifo_size = strtoul(optarg, NULL, 0);
+         break;
+      case 'Z': // output writer backlog
+         settings.writer_backlog_mb = atoi(optarg);
+         break;
 //      case 't': // do FFT
 //	      settings.do_fft = 1;
 //	      break;
@@ -248,6 +446,12 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
 	         settings.do_iq = 1;
 	         settings.do_fft = 1;
 	         got_mode_string = true;
+	      } else if( 0 == strcmp("chan", argv[optind]) ) {
+	         settings.do_chan = 1;
+	         got_mode_string = true;
+	      } else if( 0 == strcmp("bench", argv[optind]) ) {
+	         settings.do_bench = 1;
+	         got_mode_string = true;
 	      } else {
             std::cerr << "Unrecognized mode string '" << argv[optind] << "'\n";
             usage(argv[0]);
@@ -267,7 +471,7 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
 
 	if(optind == argc - 1) {
 	   // only one filename provided
-	   if( settings.do_iq == 1 ) {
+	   if( settings.do_iq == 1 || settings.do_chan == 1 || settings.do_bench == 1 ) {
 	      // iq filename provided, default fft filename to be used
    	   settings.samples_outfilename = argv[optind];
          std::cerr << "iq filename: " << settings.samples_outfilename << std::endl;
@@ -291,13 +495,59 @@ void parse_args(int argc, char* argv[], SettingsT& settings) {
 	}
    
 	
+   if( !settings.output_format_set ) {
+      settings.output_format = native_format(settings.sample_bits);
+   }
+   if( settings.dither && settings.output_format != IQ_CS8 && settings.output_format != IQ_CU8 ) {
+      std::cerr << "-N only applies to cs8 and cu8 output; ignoring\n";
+      settings.dither = false;
+   }
+
+   if( settings.client_fft && !settings.do_fft ) {
+      std::cerr << "-C only applies to fft and both modes; ignoring\n";
+      settings.client_fft = false;
+   }
+
+   if( (settings.do_iq || settings.do_chan || settings.client_fft) && !settings.do_bench ) {
+      uint64_t min_fifo = ss_client_if::min_fifo_size(settings.sample_bits, settings.batch_size);
+      if( min_fifo > UINT32_MAX ) {
+         std::cerr << "-a " << settings.batch_size << " needs a sample FIFO over 4 GB\n";
+         usage(argv[0]);
+         exit(1);
+      }
+      if( settings.fifo_size < min_fifo ) {
+         std::cerr << "-z " << settings.fifo_size << " is less than two frames or two -a batches; using "
+                   << min_fifo << "\n";
+         settings.fifo_size = min_fifo;
+      }
+   }
+
+   if( settings.do_chan && settings.channel_freqs.empty() ) {
+      std::cerr << "chan mode needs the channel frequencies, -K\n";
+      usage(argv[0]);
+      exit(1);
+   }
+   if( settings.do_chan && 0 == strcmp(settings.samples_outfilename, "-") ) {
+      std::cerr << "chan mode writes a file per channel and needs an iq outfile name, not stdout\n";
+      usage(argv[0]);
+      exit(1);
+   }
+
+   if( settings.record_sigmf && settings.do_iq && 0 == strcmp(settings.samples_outfilename, "-") ) {
+      std::cerr << "A SigMF recording needs an iq outfile name, not stdout\n";
+      usage(argv[0]);
+      exit(1);
+   }
+
    if( 0 == strcmp(settings.samples_outfilename, settings.fft_outfilename) ) {
       std::cerr << "Refusing to emit both samples and fft data to the same output stream! :-p\n";
       usage(argv[0]);
       exit(1);
    }
 
-   // adjust fft size to provide requested resolution
+   // adjust fft size to provide requested resolution; -C works it out
+   // again once the iq rate is known
+   settings.fft_resolution = fft_resolution;
    int bins_for_res =  settings.sample_rate / fft_resolution;
    settings.fft_bins = std::pow(2, std::ceil(std::log2(bins_for_res)));
    // max bins spyserver allows
@@ -333,90 +583,328 @@ double get_monotonic_seconds() {
    return result;
 }
 
+// Turn the IQ stream gaps reported so far into SigMF annotations in each
+// of the count recordings in metas. Gap positions count FIFO samples;
+// ratio maps them to samples written out. The lost samples aren't in the
+// file, so each annotation marks the join where they should have been:
+// the transient samples from there on that filtering smeared it into.
+void collect_iq_gaps( ss_client_if& server, sigmf_meta* const* metas, size_t count, double ratio,
+                      uint64_t transient ) {
+
+   iq_gap gap;
+   while( server.next_iq_gap(gap) ) {
+      if( 0 == count ) {
+         continue;
+      }
+      uint64_t start = std::llround(gap.sample_index * ratio);
+      uint64_t lost = std::max<uint64_t>(std::llround(gap.lost_samples * ratio), 1);
+      std::string comment = "discontinuity, " + std::to_string(lost) +
+         (gap.overflow ? " samples dropped, client FIFO overflow" : " samples lost from SpyServer");
+      for( size_t i = 0; i < count; ++i ) {
+         metas[i]->add_annotation(start, transient, lost, comment);
+      }
+   }
+}
+
+// Output samples spoiled by a discontinuity that went through a filter
+// taps long at input_rate, for output at output_rate
+uint64_t filter_transient( uint32_t taps, double input_rate, double output_rate ) {
+   return (uint64_t)std::ceil(taps * output_rate / input_rate);
+}
+
+// Take batches of samples from the FIFO in place, convert (and resample)
+// them to the output format unless they can go out as they are, and
+// hand them to the writer, and to the -C spectrum if there is one. T is
+// the FIFO sample type for -b.
+template <class T>
+void iq_work_loop( ss_client_if& server, SettingsT& settings, iq_converter& conv,
+                   iq_writer& out, sigmf_meta* meta, double ratio, uint64_t transient,
+                   iq_spectrum* spectrum, unsigned int& rxd ) {
+
+   const unsigned int batch_sz = settings.batch_size;
+   const bool passthrough = conv.passthrough();
+   while(settings.samples == 0 || rxd < settings.samples) {
+      iq_span<T> span = server.acquire_iq<T>(batch_sz);
+      collect_iq_gaps(server, &meta, NULL != meta ? 1 : 0, ratio, transient);
+      unsigned int samps = std::min((unsigned int)span.samples, batch_sz);
+      if( NULL != spectrum ) {
+         spectrum->process(span.data, samps);
+      }
+      const char* data = (const char*)span.data;
+      size_t gen = samps;
+      if( !passthrough ) {
+         // the converter keeps any resampler history, so the whole span is used up
+         gen = conv.convert(span.data, samps);
+         data = conv.output();
+      }
+      bool ok = out.write(data, gen*conv.output_sample_bytes());
+      server.release_iq<T>(samps);
+      if( !ok ) {
+         break;
+      }
+      rxd += gen;
+   }
+}
+
+// chan mode output for the channel at freq: name with _<Hz> inserted
+// before the extension of its last path component, if it has one
+std::string channel_filename( const std::string& name, double freq ) {
+
+   std::string tag = "_" + std::to_string(std::llround(freq));
+   size_t slash = name.rfind('/');
+   size_t dot = name.rfind('.');
+   if( dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1 ) {
+      return name + tag;
+   }
+   return name.substr(0, dot) + tag + name.substr(dot);
+}
+
+// chan mode: take batches from the FIFO, split them into channels in one
+// filterbank pass and convert (and resample) each channel into its own
+// writer. rxd counts the samples written per channel.
+template <class T>
+void chan_work_loop( ss_client_if& server, SettingsT& settings, iq_converter& wide,
+                     pfb_channelizer& chan, std::vector<iq_converter*>& convs,
+                     std::vector<iq_writer*>& outs, std::vector<sigmf_meta*>& metas,
+                     double ratio, uint64_t transient, unsigned int& rxd ) {
+
+   const unsigned int batch_sz = settings.batch_size;
+   const bool passthrough = wide.passthrough();
+   bool ok = true;
+   while( ok && (settings.samples == 0 || rxd < settings.samples) ) {
+      iq_span<T> span = server.acquire_iq<T>(batch_sz);
+      collect_iq_gaps(server, metas.data(), metas.size(), ratio, transient);
+      unsigned int samps = std::min((unsigned int)span.samples, batch_sz);
+      const float* in = (const float*)span.data;
+      if( !passthrough ) {
+         wide.convert(span.data, samps);
+         in = (const float*)wide.output();
+      }
+      // the filterbank keeps the history it needs, so the span can go back
+      size_t frames = chan.process(in, samps);
+      server.release_iq<T>(samps);
+
+      size_t gen = 0;
+      for( size_t c = 0; c < outs.size(); ++c ) {
+         gen = convs[c]->convert(chan.output(c), frames);
+         ok = outs[c]->write(convs[c]->output(), gen*convs[c]->output_sample_bytes()) && ok;
+      }
+      rxd += gen;
+   }
+}
+
+// Set up chan mode for the -K channels, run it and finish the outputs
+void run_channels( ss_client_if& server, SettingsT& settings, unsigned int& rxd ) {
+
+   const double in_rate = server.get_sample_rate();
+   // channels at least twice the output rate apart leave the whole output
+   // band inside a channel's flat +-0.75 spacings wherever a frequency
+   // falls between channel centres
+   uint32_t channels = 2;
+   while( in_rate / (channels * 2) >= 2 * settings.output_rate ) {
+      channels <<= 1;
+   }
+   pfb_channelizer chan(in_rate, channels, settings.fft_threads);
+   std::cerr << "Channelizer: " << channels << " channels " << chan.spacing() << " Hz apart at "
+             << chan.output_rate() << " samp/sec, " << settings.fft_threads << " threads" << std::endl;
+
+   const size_t count = settings.channel_freqs.size();
+   const size_t max_frames = chan.max_output(settings.batch_size);
+   const uint64_t sample_bytes = IqFormats[settings.output_format].sample_bytes;
+   const size_t writer_buffers = std::max<size_t>((uint64_t)settings.writer_backlog_mb * 1024 * 1024 / WriterBufferSize, 2);
+   // FIFO sample positions to channel output positions
+   const double ratio = settings.output_rate / in_rate;
+   std::vector<poly_resampler*> resamplers;
+   std::vector<iq_converter*> convs;
+   std::vector<iq_writer*> outs;
+   std::vector<sigmf_meta*> metas;
+   for( size_t c = 0; c < count; ++c ) {
+      double freq = settings.channel_freqs[c];
+      chan.add_output(freq - settings.center_freq);
+      poly_resampler* resampler = NULL;
+      if( chan.output_rate() != settings.output_rate ) {
+         resampler = new poly_resampler(chan.output_rate(), settings.output_rate, settings.resample_quality);
+      }
+      resamplers.push_back(resampler);
+      iq_converter* conv = new iq_converter(IQ_CF32, settings.output_format, resampler, max_frames);
+      conv->set_dither(settings.dither);
+      convs.push_back(conv);
+
+      std::string filename = channel_filename(settings.samples_outfilename, freq);
+      if( settings.record_sigmf ) {
+         sigmf_meta* meta = new sigmf_meta(filename);
+         meta->set_datatype(IqFormats[settings.output_format].sigmf_datatype);
+         meta->set_sample_rate(settings.output_rate);
+         meta->set_frequency(freq);
+         meta->set_description(std::string("SpyServer ") + settings.server + ":" + std::to_string(settings.port) +
+                               ", channel " + std::to_string(c + 1) + " of " + std::to_string(count));
+         meta->set_device(server.get_device_info(), server.get_client_sync());
+         meta->set_capture_start(std::chrono::system_clock::now());
+         meta->write();
+         metas.push_back(meta);
+         filename = meta->data_filename();
+      }
+      outs.push_back(new iq_writer(filename, WriterBufferSize, writer_buffers,
+                                   settings.samples * sample_bytes, settings.writer_uring,
+                                   settings.writer_vmsplice));
+      std::cerr << "Channel " << freq << " Hz (filterbank channel " << chan.output_channel(c)
+                << "): " << filename << std::endl;
+   }
+
+   // a discontinuity smears through the filterbank prototype, then the resampler
+   uint64_t transient = filter_transient(pfb_channelizer::TapsPerBranch * channels, in_rate,
+                                         settings.output_rate);
+   if( NULL != resamplers[0] ) {
+      transient += filter_transient(resamplers[0]->taps(), chan.output_rate(), settings.output_rate);
+   }
+
+   iq_converter wide(native_format(settings.sample_bits), IQ_CF32, NULL, settings.batch_size);
+   if( settings.remove_dc ) {
+      wide.set_dc_removal(in_rate * DcTimeConstantSeconds);
+   }
+
+   if(settings.sample_bits == 32) {
+      chan_work_loop<float>(server, settings, wide, chan, convs, outs, metas, ratio, transient, rxd);
+   } else if(settings.sample_bits == 24) {
+      chan_work_loop<int32_t>(server, settings, wide, chan, convs, outs, metas, ratio, transient, rxd);
+   } else if(settings.sample_bits == 16) {
+      chan_work_loop<int16_t>(server, settings, wide, chan, convs, outs, metas, ratio, transient, rxd);
+   } else {
+      chan_work_loop<uint8_t>(server, settings, wide, chan, convs, outs, metas, ratio, transient, rxd);
+   }
+
+   for( iq_writer* out : outs ) {
+      out->close();
+      out->print_stats(std::cerr);
+      delete out;
+   }
+   // gaps past the last sample written are not part of the recordings
+   collect_iq_gaps(server, metas.data(), metas.size(), ratio, transient);
+   for( sigmf_meta* meta : metas ) {
+      meta->truncate(rxd);
+      meta->write();
+      std::cerr << "SigMF metadata: " << meta->meta_filename() << " ("
+                << meta->annotations() << " gap annotations)" << std::endl;
+      delete meta;
+   }
+   for( size_t c = 0; c < count; ++c ) {
+      delete convs[c];
+      delete resamplers[c];
+   }
+}
+
+// fft mode with -C: the iq stream only feeds the spectrum
+template <class T>
+void spectrum_work_loop( ss_client_if& server, const SettingsT& settings,
+                         iq_spectrum& spectrum, bool& running ) {
+
+   while( running ) {
+      iq_span<T> span = server.acquire_iq<T>(settings.batch_size);
+      collect_iq_gaps(server, NULL, 0, 1.0, 1);
+      spectrum.process(span.data, span.samples);
+      server.release_iq<T>(span.samples);
+   }
+}
+
+// Report averaged spectra, from the server's FFT stream or, with -C, from
+// the spectrum computed here, whose bins are always linear power
 void fft_work_thread( ss_client_if& server,
+                      iq_spectrum* spectrum,
                       const SettingsT& settings,
+                      power_writer& log,
                       bool& running ) {
 
    std::vector<uint32_t> fft_data;
+   std::vector<float> fft_power;
    int periods = 0;
    std::vector<uint32_t> fft_data_sums;
+   std::vector<double> fft_power_sums;
    int sum_periods = 0;
 
-   uint32_t bandwidth = server.get_bandwidth();
+   const bool linear = settings.fft_linear || NULL != spectrum;
+   double bandwidth = NULL != spectrum ? server.get_sample_rate() : server.get_bandwidth();
    double last_start = get_monotonic_seconds();
+   std::chrono::system_clock::time_point row_time = std::chrono::system_clock::now();
+   size_t layout_pts = 0;
 
     while( running ) {
    
-      server.get_fft_data( fft_data, periods );
+      // with -C the last call of an interval also takes the frames not yet
+      // transformed, and that interval is reported however long the call took
+      bool closing = get_monotonic_seconds() - last_start > settings.fft_average_seconds;
+
+      if( linear ) {
+         if( NULL != spectrum ) {
+            spectrum->get_power( fft_power, periods, closing );
+         } else {
+            server.get_fft_power( fft_power, periods );
+         }
+         if( fft_power_sums.size() < fft_power.size() ) {
+            fft_power_sums.resize(fft_power.size());
+         }
+         if( fft_power.size() > 0 && periods > 0 ) {
+            size_t num_pts = fft_power.size();
+            for (size_t i = 0; i < num_pts; ++i)
+            {
+               fft_power_sums[i] += fft_power[i];
+            }
+            sum_periods += periods;
+         }
+      } else {
+         server.get_fft_data( fft_data, periods );
       
-      // TODO: Configure fft bins in source interface and these sizes up front
-      if( fft_data_sums.size() < fft_data.size() ) {
-         fft_data_sums.resize(fft_data.size());
-      }
+         // TODO: Configure fft bins in source interface and these sizes up front
+         if( fft_data_sums.size() < fft_data.size() ) {
+            fft_data_sums.resize(fft_data.size());
+         }
       
-      if( fft_data.size() > 0 && periods > 0 ) {
-         // accumulate data
-         size_t num_pts = fft_data.size();
-         for (size_t i = 0; i < num_pts; ++i)
-         {
-            fft_data_sums[i] += fft_data[i];
+         if( fft_data.size() > 0 && periods > 0 ) {
+            // accumulate data
+            size_t num_pts = fft_data.size();
+            for (size_t i = 0; i < num_pts; ++i)
+            {
+               fft_data_sums[i] += fft_data[i];
+            }
+            sum_periods += periods;
          }
-         sum_periods += periods;
       }
 
       double now = get_monotonic_seconds();
       
-      if( now - last_start > settings.fft_average_seconds ) {
-         double hz_step = bandwidth / fft_data.size();
-         double fft_hz_low = settings.center_freq - (bandwidth / 2.0);
-         double fft_hz_high = settings.center_freq + (bandwidth / 2.0);
-         double hz_low = fft_hz_low;
-         double hz_high = fft_hz_high;
-
-         if( hz_low < settings.low_freq ) {
-            unsigned int lowsteps = std::ceil((settings.low_freq - fft_hz_low) / hz_step);
-            hz_low = fft_hz_low + (hz_step * lowsteps);
-            //std::cerr << "lowsteps: " << lowsteps << "\n";
-         }
-         if( hz_high > settings.high_freq ) {
-            unsigned int highsteps = std::ceil((settings.high_freq - fft_hz_low) / hz_step);
-            hz_high = fft_hz_low + (hz_step * highsteps);
-            //std::cerr << "highsteps: " << highsteps << "\n";
+      // nothing to report when -C stopped before its first frame
+      if( (NULL != spectrum ? closing : now - last_start > settings.fft_average_seconds) &&
+          sum_periods > 0 ) {
+         size_t num_pts = linear ? fft_power_sums.size() : fft_data_sums.size();
+
+         if( num_pts != layout_pts ) {
+            // the bin window only changes with the fft size
+            double hz_step = bandwidth / (double)num_pts;
+            double fft_hz_low = settings.center_freq - (bandwidth / 2.0);
+            log.set_layout(fft_hz_low, hz_step, num_pts, settings.low_freq, settings.high_freq);
+            layout_pts = num_pts;
          }
 
-         // dump to output file
-         // create rtl_power-like header
-         // # date, time, Hz low, Hz high, Hz step, samples, dB, dB, dB, ...
-         // need only hz low and hz step
-         std::ofstream outfile (settings.fft_outfilename);
-         outfile << "date, time, " << (unsigned int)hz_low << ", "
-                 << (unsigned int)hz_high << ", "
-                 << hz_step << ", "
-                 << "1";
-
-         size_t num_pts = fft_data_sums.size();
-//         std::cerr << "processing " << num_pts << " points from " << fft_hz_low
-//                   << " to " << fft_hz_high << std::endl;
-         
-//         uint32_t wrote = 0;
-         for (size_t i = 0; i < num_pts; ++i)
+         // dump to output file, one rtl_power-like row:
+         // date, time, Hz low, Hz high, Hz step, samples, dB, dB, dB, ...
+         log.begin_row(row_time, sum_periods);
+         for (size_t i = log.first_bin(); i <= log.last_bin(); ++i)
          {
-            double cur_hz = fft_hz_low + (hz_step * i);
-            if( cur_hz >= hz_low && cur_hz <= hz_high ) {
-               outfile << ", " << (fft_data_sums[i] / sum_periods);
-//               ++wrote;
+            if( linear ) {
+               // back to dB only now, after averaging the power
+               log.add(10.0 * std::log10(fft_power_sums[i] / sum_periods));
             } else {
-               // nop
+               log.add(fft_data_sums[i], sum_periods);
             }
-            fft_data_sums[i] = 0;
          }
-         outfile << std::endl;
+         log.end_row();
 
+         std::fill(fft_power_sums.begin(), fft_power_sums.end(), 0);
+         std::fill(fft_data_sums.begin(), fft_data_sums.end(), 0);
          sum_periods = 0;
          last_start = now;
+         row_time = std::chrono::system_clock::now();
          
          if( settings.oneshot == 1 ) {
-            outfile.close();
             running = false;         
          }
 
@@ -429,22 +917,81 @@ void fft_work_thread( ss_client_if& server,
 
 }
 
+// Time writing a cs16 stream to settings.samples_outfilename in -a sized
+// batches, through std::ofstream::write (the old output path), the
+// iq_writer thread with pwritev, and iq_writer with io_uring. Each run
+// includes an fdatasync so page cache buffering doesn't flatter the
+// buffered writers against O_DIRECT.
+int run_output_bench(const SettingsT& settings) {
+   std::string filename = settings.samples_outfilename;
+   if( filename == "-" ) {
+      filename = "ss_client_bench.bin";
+   }
+   const uint64_t total = (settings.samples ? settings.samples : 64 * 1024 * 1024) * 4;
+   std::vector<uint32_t> batches = { 1024, 8192, 32768, 131072 };
+   if( std::find(batches.begin(), batches.end(), settings.batch_size) == batches.end() ) {
+      batches.push_back(settings.batch_size);
+      std::sort(batches.begin(), batches.end());
+   }
+   size_t writer_buffers = std::max<size_t>((uint64_t)settings.writer_backlog_mb * 1024 * 1024 / WriterBufferSize, 2);
+
+   std::cerr << "Writing " << total / 1e6 << " MB of cs16 to " << filename << " per run\n"
+             << std::setw(8) << "batch" << std::setw(14) << "ofstream"
+             << std::setw(14) << "pwritev" << std::setw(14) << "io_uring" << "  (MB/s)" << std::endl;
+
+   for( uint32_t batch : batches ) {
+      std::vector<char> src(batch * 4);
+      for( size_t i = 0; i < src.size(); ++i ) {
+         src[i] = (char)i;
+      }
+      double rate[3];
+      for( int method = 0; method < 3; ++method ) {
+         double start = get_monotonic_seconds();
+         if( method == 0 ) {
+            std::ofstream outfile(filename, std::ofstream::binary);
+            for( uint64_t done = 0; done < total; done += src.size() ) {
+               outfile.write(src.data(), src.size());
+            }
+         } else {
+            iq_writer out(filename, WriterBufferSize, writer_buffers, total, method == 2);
+            for( uint64_t done = 0; done < total; done += src.size() ) {
+               out.write(src.data(), src.size());
+            }
+         }
+         int fd = open(filename.c_str(), O_WRONLY);
+         if( fd >= 0 ) {
+            fdatasync(fd);
+            close(fd);
+         }
+         rate[method] = total / 1e6 / (get_monotonic_seconds() - start);
+      }
+      std::cerr << std::setw(8) << batch << std::fixed << std::setprecision(1)
+                << std::setw(14) << rate[0] << std::setw(14) << rate[1]
+                << std::setw(14) << rate[2] << std::endl;
+   }
+   unlink(filename.c_str());
+   return 0;
+}
+
 int main(int argc, char* argv[]) {
 
    unsigned int rxd = 0;
    SettingsT settings;
-   // resampler support   
-//   int16_t*   out_short = NULL;
-   float*     in_f = NULL;
-   float*     out_f = NULL;
-   SRC_STATE* resampler = NULL;
-   SRC_DATA   data;
+   // resampler support
+   poly_resampler* resampler = NULL;
 
    parse_args(argc, argv, settings);
+
+   if( settings.do_bench ) {
+      return run_output_bench(settings);
+   }
       
    const unsigned int batch_sz = settings.batch_size;
 
-   ss_client_if server (settings.server, settings.port, settings.do_iq, settings.do_fft, settings.fft_bins, settings.sample_bits);
+   // -C computes spectra from the iq stream instead of the server's fft stream
+   const uint8_t stream_iq = settings.do_iq || settings.do_chan || settings.client_fft;
+   const uint8_t stream_fft = settings.do_fft && !settings.client_fft;
+   ss_client_if server (settings.server, settings.port, stream_iq, stream_fft, settings.fft_bins, settings.sample_bits, settings.fft_bits, settings.fifo_size, settings.sync_timeout_ms);
 
    // Get sample rate info and decide which one to ask for; set up resampler if needed
    uint32_t max_samp_rate;
@@ -470,6 +1017,36 @@ int main(int argc, char* argv[]) {
                settings.sample_rate = cand_rate;
             }
          }
+      } else if( settings.do_chan == 1 ) {
+         // the narrowest iq rate with every channel's band inside the
+         // middle 90%, and room for at least two filterbank channels
+         double reach = 0;
+         for( double freq : settings.channel_freqs ) {
+            reach = std::max(reach, std::fabs(freq - settings.center_freq));
+         }
+         reach += settings.output_rate / 2.0;
+         for( unsigned int i = 0; i < decim_stages; ++i ) {
+            double cand_rate = max_samp_rate / (double)(1 << i);
+            if( 0.45 * cand_rate >= reach && cand_rate >= 4 * settings.output_rate ) {
+               desired_decim_stage = i;
+            }
+         }
+         if( desired_decim_stage < 0 ) {
+            std::cerr << "The -K channels do not fit in " << max_samp_rate
+                      << " samp/sec around " << settings.center_freq << " Hz\n";
+            exit(1);
+         }
+         settings.sample_rate = max_samp_rate / (double)(1 << desired_decim_stage);
+      } else if( settings.client_fft ) {
+         // the narrowest iq rate that still covers -s; no resampling
+         desired_decim_stage = 0;
+         for( unsigned int i = 1; i < decim_stages; ++i ) {
+            if( max_samp_rate / (1 << i) >= settings.sample_rate ) {
+               desired_decim_stage = i;
+            }
+         }
+         settings.sample_rate = max_samp_rate / (1 << desired_decim_stage);
+         settings.output_rate = settings.sample_rate;
       } else if( settings.do_fft == 1 ) {
          settings.output_rate = max_samp_rate;
          desired_decim_stage = 0;
@@ -490,9 +1067,11 @@ int main(int argc, char* argv[]) {
       exit(1);
    }
 
-   // Hack to let the client sync block come back from the spyserver.
-   //TODO: Implement flag-based wait for next client sync block in ss_client_if
-   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+   // set_sample_rate_by_decim_stage() returns once the resulting client
+   // sync block has come back from the spyserver (or sync_timeout expires)
+
+   // tune, rate and gain go out in one write, confirmed by one client sync
+   server.begin_batch();
 
    std::cerr << "ss_client: setting center_freq to " << settings.center_freq << std::endl;
    if(!server.set_center_freq(settings.center_freq)) {
@@ -518,117 +1097,163 @@ int main(int argc, char* argv[]) {
       exit(1);
    }
 
-   // if the resample_ratio is not 1, we need a resampler.
-   data.output_frames_gen = batch_sz; // re-use for no-resampler case too
-
-   int error;
+   if(!server.end_batch()) {
+      std::cerr << "Failed to send settings\n";
+      exit(1);
+   }
 
+   // if the resample_ratio is not 1, we need a resampler.
    if( resample_ratio != 1.0 ) {
-      in_f = new float[batch_sz*2];
-      out_f = new float[batch_sz*2];
-
-      data.data_in = in_f;
-      data.data_out = out_f;
-      data.end_of_input = 0;
-      data.output_frames = batch_sz;
-      data.src_ratio = resample_ratio;
-      resampler = src_new(settings.resample_quality, 2, &error);
-      if( NULL == resampler ) {
-         std::cerr << "Resampler error: " << src_strerror(error) << std::endl;
+      try {
+         resampler = new poly_resampler(max_samp_rate / double(1 << desired_decim_stage),
+                                        settings.output_rate, settings.resample_quality);
+      } catch( std::exception& e ) {
+         std::cerr << "Resampler error: " << e.what() << std::endl;
          exit(1);
       }
+      std::cerr << "Resampling " << resampler->interpolation() << "/" << resampler->decimation()
+                << " with " << resampler->phases() << " phases of " << resampler->taps()
+                << " taps, delay " << resampler->delay() << " samples" << std::endl;
+   }
+
+   if( settings.low_latency_ms > 0 ) {
+      server.set_low_latency(true, settings.low_latency_ms);
+   }
+
+   if( settings.fft_linear && stream_fft ) {
+      server.set_fft_linear_power(true);
+   }
+
+   // the output rate, and how FIFO sample positions map onto it
+   double written_ratio = NULL != resampler ? resample_ratio : 1.0;
+   uint64_t gap_transient = NULL != resampler ?
+      filter_transient(resampler->taps(), 1.0, written_ratio) : 1;
+   sigmf_meta* meta (NULL);
+   if( settings.do_iq != 0 && settings.record_sigmf ) {
+      meta = new sigmf_meta(settings.samples_outfilename);
+      meta->set_datatype(IqFormats[settings.output_format].sigmf_datatype);
+      meta->set_sample_rate(server.get_sample_rate() * written_ratio);
+      meta->set_description(std::string("SpyServer ") + settings.server + ":" + std::to_string(settings.port));
+      meta->set_device(server.get_device_info(), server.get_client_sync());
+      meta->set_capture_start(std::chrono::system_clock::now());
+      meta->write();
+      std::cerr << "SigMF recording: " << meta->data_filename() << std::endl;
    }
 
    server.start();
 
    std::thread* fft_thread (NULL);
+   power_writer* fft_log (NULL);
+   iq_spectrum* spectrum (NULL);
    bool running = true;
+   if( settings.client_fft ) {
+      // bins for -e at the rate the iq stream actually runs at
+      double bins_for_res = server.get_sample_rate() / settings.fft_resolution;
+      settings.fft_bins = 16;
+      while( settings.fft_bins < bins_for_res && settings.fft_bins < MaxClientFftBins ) {
+         settings.fft_bins <<= 1;
+      }
+      spectrum = new iq_spectrum(native_format(settings.sample_bits), settings.fft_bins,
+                                 settings.fft_window, settings.fft_overlap, settings.fft_threads,
+                                 settings.batch_size);
+      std::cerr << "Client fft: " << spectrum->bins() << " bins of "
+                << server.get_sample_rate() / spectrum->bins() << " Hz, hop "
+                << spectrum->hop() << " samples, " << settings.fft_threads << " threads" << std::endl;
+   }
    if( settings.do_fft != 0 ) {
-      fft_thread = new std::thread(fft_work_thread, std::ref(server), std::ref(settings), std::ref(running));
+      fft_log = new power_writer(settings.fft_outfilename, settings.fft_format,
+                                 settings.fft_average_seconds, settings.fft_rotate_seconds);
+      // server bin values to dB, for the binary format's header
+      fft_log->set_units(server.fft_bin_to_db(0), server.fft_bin_to_db(1) - server.fft_bin_to_db(0));
+      fft_thread = new std::thread(fft_work_thread, std::ref(server), spectrum, std::ref(settings),
+                                   std::ref(*fft_log), std::ref(running));
    }
 
    double start = get_monotonic_seconds();
    
    if( settings.do_iq != 0 ) {
-      std::ostream* out;
-      std::ofstream outfile;
-      if(strcmp("-", settings.samples_outfilename) == 0) {
-         out = &std::cout;
-      } else {
-         outfile.open(settings.samples_outfilename, std::ofstream::binary);
-         out = &outfile;
-      }
+      // bytes per complex sample as written out; lets files be
+      // preallocated when the sample count is known
+      uint64_t sample_bytes = IqFormats[settings.output_format].sample_bytes;
+      iq_writer out(NULL != meta ? meta->data_filename() : std::string(settings.samples_outfilename), WriterBufferSize,
+                    std::max<size_t>((uint64_t)settings.writer_backlog_mb * 1024 * 1024 / WriterBufferSize, 2),
+                    settings.samples * sample_bytes, settings.writer_uring,
+                    settings.writer_vmsplice);
 
-   
-      
-      if(settings.sample_bits == 16) {
-         // 16-bit samples
-         unsigned int samps;
-         // each 'sample' is 2 bytes I + 2 bytes Q
-         char* buf = new char[batch_sz*2*2];
-         unsigned int unused = 0;
-         unsigned int available = batch_sz;
-         while(settings.samples == 0 || rxd < settings.samples) {
-            samps = server.get_iq_data(available,((int16_t*)buf)+unused);
-//            std::cerr << "Asked for " << available << " got " << samps << " samples from server" << std::endl;
-            if( resampler != NULL ) {
-//               std::cerr << "converting buffer to floats\n";
-               src_short_to_float_array ((int16_t*)buf, in_f, samps*2);
-               data.input_frames = samps;
-               error = src_process(resampler, &data);
-               if( 0 != error ) {
-                  std::cerr << "Resampler process error: " << src_strerror(error) << std::endl;
-                  exit(1);
-               }
-//               std::cerr << "Resampler read " << data.input_frames_used << " and produced "
-//                 << data.output_frames_gen << std::endl;
-//               std::cerr << "converting float buffer to shorts\n";
-               src_float_to_short_array(data.data_out, (int16_t*)buf, data.output_frames_gen*2);
-               unused = data.input_frames - data.input_frames_used;
-               available = batch_sz - unused;
-//               std::cerr << "unused: " << unused  << " available: " << available << std::endl;
-               // move unused to beginning of buffer
-               uint16_t* s_buf = (uint16_t*)buf;
-//               std::cerr << "Moving unused input data to front of buffer\n";
-               for( unsigned int i = 0; i < unused; ++i ) {
-                  s_buf[i] = s_buf[data.input_frames_used + i];
-               }
-            }
+      iq_converter conv(native_format(settings.sample_bits), settings.output_format, resampler, batch_sz);
+      if( settings.remove_dc ) {
+         conv.set_dc_removal(server.get_sample_rate() * DcTimeConstantSeconds);
+      }
+      conv.set_dither(settings.dither);
 
-            rxd += data.output_frames_gen;
-            
-            out->write(buf, data.output_frames_gen*2*2);
-//            std::cerr << "w16 " << std::flush;
-         }
+      // the FIFO holds 24-bit samples unpacked to cs32
+      if(settings.sample_bits == 32) {
+         iq_work_loop<float>(server, settings, conv, out, meta, written_ratio, gap_transient, spectrum, rxd);
+      } else if(settings.sample_bits == 24) {
+         iq_work_loop<int32_t>(server, settings, conv, out, meta, written_ratio, gap_transient, spectrum, rxd);
+      } else if(settings.sample_bits == 16) {
+         iq_work_loop<int16_t>(server, settings, conv, out, meta, written_ratio, gap_transient, spectrum, rxd);
       } else {
-         // 8-bit samples
-         char* data = new char[batch_sz*2];
-         while(settings.samples == 0 || rxd < settings.samples) {
-            rxd += server.get_iq_data(batch_sz,(uint8_t*)data);
-            out->write(data, batch_sz*2);
-//            std::cerr << "w8 " << std::flush;
-         }
+         iq_work_loop<uint8_t>(server, settings, conv, out, meta, written_ratio, gap_transient, spectrum, rxd);
       }
-      
-      if(out != &std::cout) {
-         dynamic_cast<std::ofstream*>(out)->close();   
+
+      out.close();
+      out.print_stats(std::cerr);
+
+      if( NULL != meta ) {
+         // gaps past the last sample written are not part of the recording
+         collect_iq_gaps(server, &meta, 1, written_ratio, gap_transient);
+         meta->truncate(rxd);
+         meta->write();
+         std::cerr << "SigMF metadata: " << meta->meta_filename() << " ("
+                   << meta->annotations() << " gap annotations)" << std::endl;
+         delete meta;
       }
 
       running = false;
+   } else if( settings.do_chan != 0 ) {
+      try {
+         run_channels(server, settings, rxd);
+      } catch( std::exception& e ) {
+         std::cerr << "Channelizer error: " << e.what() << std::endl;
+         exit(1);
+      }
+   } else if( NULL != spectrum ) {
+      if(settings.sample_bits == 32) {
+         spectrum_work_loop<float>(server, settings, *spectrum, running);
+      } else if(settings.sample_bits == 24) {
+         spectrum_work_loop<int32_t>(server, settings, *spectrum, running);
+      } else if(settings.sample_bits == 16) {
+         spectrum_work_loop<int16_t>(server, settings, *spectrum, running);
+      } else {
+         spectrum_work_loop<uint8_t>(server, settings, *spectrum, running);
+      }
    }
    
   double stop = get_monotonic_seconds();
 
+  if( NULL != spectrum ) {
+      // the fft thread may be waiting on a frame that will never come
+      spectrum->stop();
+      if( spectrum->frames_dropped() > 0 ) {
+         std::cerr << "Client fft: " << spectrum->frames_dropped()
+                   << " frames dropped, the fft threads fell behind" << std::endl;
+      }
+  }
+
   if( NULL != fft_thread && fft_thread->joinable() ) {
       fft_thread->join();
    } else {
 //      std::cerr << "thread not joinable.\n";
    }
+   delete fft_log;
+   delete spectrum;
    
    std::cerr << "Received " << rxd << " samples in " << (stop - start)
              << " sec (" << rxd/(stop-start) << " samp/sec)" << std::endl;
 
    server.stop();
+   delete resampler;
    
    return 0;
 }
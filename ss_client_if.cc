@@ -10,12 +10,15 @@
 #include <algorithm>
 #include <memory>
 #include <cstring>
+#include <cmath>
 #include <iomanip>
 #include <fstream>
 
 
 #include "ss_client_if.h"
 #include "spyserver_protocol.h"
+#include "sample_convert.h"
+#include "fft_accumulate.h"
 
 
 ss_client_if::ss_client_if (const std::string _ip,
@@ -23,24 +26,37 @@ ss_client_if::ss_client_if (const std::string _ip,
                             const uint8_t     _do_iq,
                             const uint8_t     _do_fft,
                             const uint32_t    _fft_points,
-                            const uint8_t     _samp_bits) :
+                            const uint8_t     _samp_bits,
+                            const uint8_t     _fft_bits,
+                            const uint32_t    _fifo_size,
+                            const uint32_t    _sync_timeout_ms) :
    terminated(false),
    streaming(false),
    got_device_info(false),
+   got_sync_info(false),
+   is_connected(false),
    receiver_thread(NULL),
    header_data(new uint8_t[sizeof(MessageHeader)]),
    body_buffer(NULL),
    body_buffer_length(0),
+   m_body_pool(4096, SPYSERVER_MAX_MESSAGE_BODY_SIZE),
    parser_position(0),
    last_sequence_number(0),
    ip(_ip),
    port(_port),
 
    streaming_mode(STREAM_MODE_IQ_ONLY),
+   m_batch_depth(0),
+   m_batch_wants_sync(false),
+   m_sync_count(0),
+   m_sync_timeout_ms(_sync_timeout_ms),
    _fifo(NULL),
-   m_fifo_head(0),
-   m_fifo_tail(0),
-   m_fifo_size(10 * 1024 * 1024),
+   m_fifo_size(_fifo_size),
+   m_low_latency(false),
+   m_low_latency_timeout_ms(0),
+   m_fft_linear(false),
+   m_fft_db_offset(0x00),
+   m_fft_db_range(0x7f),
    m_fft_count(0),
    m_fft_period(100),
    m_fft_bins(_fft_points),
@@ -50,16 +66,19 @@ ss_client_if::ss_client_if (const std::string _ip,
    _digitalGain(0),
    m_do_iq(_do_iq),
    m_do_fft(_do_fft),
-   m_sample_bits(_samp_bits)
+   m_sample_bits(_samp_bits),
+   m_fft_bits(_fft_bits)
 {
 
    std::cerr << "SS_client_if(" << ip << ", " << port << ")" << std::endl;
    client = tcp_client(ip, port);
 
+   m_pending_gap = iq_gap();
+
    streaming_mode = 0;
    if( m_do_iq ) {
       streaming_mode |= STREAM_TYPE_IQ;
-      _fifo = new uint8_t[m_fifo_size];
+      _fifo = new spsc_ring(m_fifo_size);
       if (!_fifo) {
        throw std::runtime_error( std::string(__FUNCTION__) + " " +
                                  "Failed to allocate a sample FIFO!" );
@@ -107,7 +126,6 @@ ss_client_if::ss_client_if (const std::string _ip,
 
 void ss_client_if::connect()
 {
-  bool hasError = false;
   if (receiver_thread != NULL) {
     return;
   }
@@ -124,29 +142,25 @@ void ss_client_if::connect()
   got_sync_info = false;
   got_device_info = false;
 
-  std::exception error;
-
   receiver_thread  = new std::thread(&ss_client_if::thread_loop, this);
 
-  for (int i=0; i<1000 && !hasError; i++) {
-    if (got_device_info) {
-      if (device_info.DeviceType == DEVICE_INVALID) {
-        error = std::runtime_error( std::string(__FUNCTION__) + " " + "Server is up but no device is available");
-        hasError = true;
-        break;
-      }
+  // the receiver signals m_sync_avail as device info and client sync arrive
+  bool ready;
+  {
+    std::unique_lock<std::mutex> lock(m_sync_lock);
+    ready = m_sync_avail.wait_for(lock, std::chrono::milliseconds(m_sync_timeout_ms), [&] {
+      return got_device_info && (device_info.DeviceType == DEVICE_INVALID || got_sync_info);
+    });
+  }
 
-      if (got_sync_info) {
-        on_connect();
-        return;
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  if (ready && device_info.DeviceType != DEVICE_INVALID) {
+    on_connect();
+    return;
   }
 
   disconnect();
-  if (hasError) {
-    throw error;
+  if (ready) {
+    throw std::runtime_error( std::string(__FUNCTION__) + " " + "Server is up but no device is available");
   }
 
   throw std::runtime_error( std::string(__FUNCTION__) + " " + "Server didn't send the device capability and synchronization info.");
@@ -156,17 +170,50 @@ void ss_client_if::disconnect()
 {
   terminated = true;
   if (is_connected) {
-    client.close_conn();
+    // wake the receiver out of epoll_wait before tearing the socket down
+    client.interrupt();
   }
 
   if (receiver_thread != NULL) {
     receiver_thread->join();
+    delete receiver_thread;
     receiver_thread = NULL;
   }
 
+  if (is_connected) {
+    print_rx_stats();
+    client.close_conn();
+    is_connected = false;
+  }
+
   cleanup();
 }
 
+void ss_client_if::print_rx_stats()
+{
+  const tcp_client::rx_stats& st = client.get_rx_stats();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - st.start).count();
+  double mbytes = st.bytes / (1024.0 * 1024.0);
+
+  auto oldflags = std::cerr.flags();
+  auto oldprec = std::cerr.precision();
+  std::cerr << "SS_client_if: Received " << std::fixed << std::setprecision(1) << mbytes
+            << " MB in " << secs << " s; "
+            << (mbytes > 0 ? st.syscalls / mbytes : 0) << " syscalls/MB, "
+            << (secs > 0 ? st.wakeups / secs : 0) << " wakeups/sec" << std::endl;
+  const buffer_pool::alloc_stats& ps = m_body_pool.get_stats();
+  std::cerr << "SS_client_if: Body buffers: " << ps.heap_allocations << " heap allocations ("
+            << ps.heap_bytes / 1024 << " KB), " << ps.reuses << " reuses" << std::endl;
+  if (_fifo) {
+    std::cerr << "SS_client_if: IQ FIFO: " << _fifo->wakeups() << " consumer wakeups ("
+              << (secs > 0 ? _fifo->wakeups() / secs : 0) << "/sec), "
+              << _fifo->dropped_bytes() << " bytes dropped on overflow" << std::endl;
+    m_iq_latency.print(std::cerr, "SS_client_if: IQ latency, socket to consumer, frames: ");
+  }
+  std::cerr.flags(oldflags);
+  std::cerr.precision(oldprec);
+}
+
 
 void ss_client_if::on_connect()
 {
@@ -192,14 +239,15 @@ void ss_client_if::on_connect()
    
    if( m_do_fft ) {
       set_setting(SETTING_FFT_DISPLAY_PIXELS, { m_fft_bins });
-      set_setting(SETTING_FFT_DB_OFFSET, { 0x00 });
-      set_setting(SETTING_FFT_DB_RANGE,  { 0x7f });
+      set_setting(SETTING_FFT_DB_OFFSET, { m_fft_db_offset });
+      set_setting(SETTING_FFT_DB_RANGE,  { m_fft_db_range });
    }
    
    // set_setting(SETTING_IQ_DIGITAL_GAIN, {0xFFFFFFFF}); //  sdrsharp sets this value to 0xffffffff
    set_setting(SETTING_IQ_DIGITAL_GAIN, {0x0});
 
    send_stream_format_commands();
+   flush_commands(false);
 
   for (unsigned int i = device_info.MinimumIQDecimation; i<=device_info.DecimationStageCount; i++) {
     uint32_t sr = device_info.MaximumSampleRate / (1 << i);
@@ -230,7 +278,11 @@ bool ss_client_if::set_setting(uint32_t settingType, std::vector<uint32_t> param
     argBytes = std::vector<uint8_t>();
   }
 
-  return send_command(CMD_SET_SETTING, argBytes);
+  if (!is_connected) {
+    return false;
+  }
+  queue_command(CMD_SET_SETTING, argBytes);
+  return true;
 }
 
 bool ss_client_if::say_hello() {
@@ -278,71 +330,76 @@ void ss_client_if::thread_loop() {
   parser_phase = AcquiringHeader;
   parser_position = 0;
 
-  char buffer[BufferSize];
+  // Frames that arrive whole are decoded in place from this arena; only a
+  // frame straddling two reads is gathered into body_buffer.
+  uint8_t *buffer = m_body_pool.acquire(BufferSize);
   try {
     while(!terminated) {
-      if (terminated) {
-        break;
-      }
-      uint32_t availableData = client.available_data();
-      if (availableData > 0) {
-        availableData = availableData > BufferSize ? BufferSize : availableData;
-        client.receive_data(buffer, availableData);
-        parse_message(buffer, availableData);
-      } else if( m_do_iq ){
-         std::this_thread::sleep_for(std::chrono::milliseconds(5));
-      } else if( m_do_fft ) {
-         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      long received;
+      if (parser_phase == ReadingData &&
+          header.BodySize - parser_position >= BufferSize / 4) {
+        // most of a large body is still outstanding: receive it straight
+        // into body_buffer rather than staging it in the arena
+        received = client.receive_some((char *)body_buffer + parser_position,
+                                       header.BodySize - parser_position);
+        m_rx_time = std::chrono::steady_clock::now();
+        if (received > 0) {
+          parser_position += received;
+          if (parser_position == header.BodySize) {
+            parser_position = 0;
+            parser_phase = AcquiringHeader;
+            dispatch_message(body_buffer);
+            release_body_buffer();
+          }
+        }
+      } else {
+        // sleeps in the kernel until data arrives or disconnect() wakes us
+        received = client.receive_some((char *)buffer, BufferSize);
+        m_rx_time = std::chrono::steady_clock::now();
+        if (received > 0) {
+          parse_message(buffer, received);
+        }
       }
     }
   } catch (std::exception &e) {
     std::cerr << "SS_client_if: Error in ThreadLoop: " << e.what() << std::endl;
   }
-  if (body_buffer != NULL) {
-    delete[] body_buffer;
-    body_buffer = NULL;
-  }
+  m_body_pool.release(buffer, BufferSize);
+  release_body_buffer();
 
   cleanup();
 }
 
-void ss_client_if::parse_message(char *buffer, uint32_t len) {
-  down_stream_bytes++;
+void ss_client_if::parse_message(const uint8_t *buffer, uint32_t len) {
+  down_stream_bytes += len;
 
-  int consumed;
+  uint32_t consumed;
   while (len > 0 && !terminated) {
     if (parser_phase == AcquiringHeader) {
-      while (parser_phase == AcquiringHeader && len > 0) {
-        consumed = parse_header(buffer, len);
-        buffer += consumed;
-        len -= consumed;
-      }
-
-      if (parser_phase == ReadingData) {
-         //TODO: Do these really need to be checked every packet?!?!
-        static uint8_t client_major = (SPYSERVER_PROTOCOL_VERSION >> 24) & 0xFF;
-        static uint8_t client_minor = (SPYSERVER_PROTOCOL_VERSION >> 16) & 0xFF;
-
-        uint8_t server_major = (header.ProtocolID >> 24) & 0xFF;
-        uint8_t server_minor = (header.ProtocolID >> 16) & 0xFF;
-        //uint16_t server_build = (header.ProtocolID & 0xFFFF);
-
-        if (client_major != server_major || client_minor != server_minor) {
-          throw std::runtime_error( std::string(__FUNCTION__) + " " + "Server is running an unsupported protocol version.");
-        }
+      consumed = parse_header(buffer, len);
+      buffer += consumed;
+      len -= consumed;
 
-        if (header.BodySize > SPYSERVER_MAX_MESSAGE_BODY_SIZE) {
-          throw std::runtime_error( std::string(__FUNCTION__) + " " + "The server is probably buggy.");
-        }
+      if (parser_phase != ReadingData) {
+        // header still incomplete, or a message without a body
+        continue;
+      }
 
-        if (body_buffer == NULL || body_buffer_length < header.BodySize) {
-          if (body_buffer != NULL) {
-            delete[] body_buffer;
-          }
+      check_header();
 
-          body_buffer = new uint8_t[header.BodySize];
-        }
+      if (len >= header.BodySize) {
+        // the whole body is here; hand it to the handlers without copying
+        const uint8_t *body = buffer;
+        buffer += header.BodySize;
+        len -= header.BodySize;
+        parser_phase = AcquiringHeader;
+        dispatch_message(body);
+        continue;
       }
+
+      // frame straddles the end of this read; gather it in a pooled buffer
+      body_buffer = m_body_pool.acquire(header.BodySize);
+      body_buffer_length = header.BodySize;
     }
 
     if (parser_phase == ReadingData) {
@@ -351,28 +408,61 @@ void ss_client_if::parse_message(char *buffer, uint32_t len) {
       len -= consumed;
 
       if (parser_phase == AcquiringHeader) {
-        // fft messages all have sequence number of 0, so can't check.
-        // if IQ wasn't requested, some still appear, but not all, so don't check
-        if (m_do_iq && header.MessageType >= MSG_TYPE_UINT8_IQ && header.MessageType <= MSG_TYPE_FLOAT_IQ) {
-          int32_t gap = header.SequenceNumber - last_sequence_number - 1;
-          last_sequence_number = header.SequenceNumber;
-          dropped_buffers += gap;
-          if (gap > 0) {
-            std::cerr << "SS_client_if: Lost " << gap << " frames from SpyServer!\n";
-          }
-        }
-        handle_new_message();
+        dispatch_message(body_buffer);
+        release_body_buffer();
       }
     }
   }
 }
 
-int ss_client_if::parse_header(char *buffer, uint32_t length) {
-  auto consumed = 0;
+void ss_client_if::release_body_buffer() {
+  if (body_buffer != NULL) {
+    m_body_pool.release(body_buffer, body_buffer_length);
+    body_buffer = NULL;
+    body_buffer_length = 0;
+  }
+}
+
+void ss_client_if::check_header() {
+  //TODO: Do these really need to be checked every packet?!?!
+  static uint8_t client_major = (SPYSERVER_PROTOCOL_VERSION >> 24) & 0xFF;
+  static uint8_t client_minor = (SPYSERVER_PROTOCOL_VERSION >> 16) & 0xFF;
+
+  uint8_t server_major = (header.ProtocolID >> 24) & 0xFF;
+  uint8_t server_minor = (header.ProtocolID >> 16) & 0xFF;
+  //uint16_t server_build = (header.ProtocolID & 0xFFFF);
+
+  if (client_major != server_major || client_minor != server_minor) {
+    throw std::runtime_error( std::string(__FUNCTION__) + " " + "Server is running an unsupported protocol version.");
+  }
+
+  if (header.BodySize > SPYSERVER_MAX_MESSAGE_BODY_SIZE) {
+    throw std::runtime_error( std::string(__FUNCTION__) + " " + "The server is probably buggy.");
+  }
+}
+
+void ss_client_if::dispatch_message(const uint8_t *body) {
+  // fft messages all have sequence number of 0, so can't check.
+  // if IQ wasn't requested, some still appear, but not all, so don't check
+  if (m_do_iq && header.MessageType >= MSG_TYPE_UINT8_IQ && header.MessageType <= MSG_TYPE_FLOAT_IQ) {
+    int32_t gap = header.SequenceNumber - last_sequence_number - 1;
+    last_sequence_number = header.SequenceNumber;
+    dropped_buffers += gap;
+    if (gap > 0) {
+      std::cerr << "SS_client_if: Lost " << gap << " frames from SpyServer!\n";
+      // assume the missing frames were the size of this one
+      note_iq_gap((uint64_t)gap * (header.BodySize / wire_sample_bytes(m_sample_bits)), false);
+    }
+  }
+  handle_new_message(body);
+}
+
+uint32_t ss_client_if::parse_header(const uint8_t *buffer, uint32_t length) {
+  uint32_t to_write = std::min((uint32_t)(sizeof(MessageHeader) - parser_position), length);
+  std::memcpy((uint8_t *)&header + parser_position, buffer, to_write);
+  parser_position += to_write;
 
-  while (length > 0) {
-    int to_write = std::min((uint32_t)(sizeof(MessageHeader) - parser_position), length);
-    std::memcpy(&header + parser_position, buffer, to_write);
+  if (parser_position == sizeof(MessageHeader)) {
 /*    
     std::cerr << "Header:"
               << "\n   ProtocolID:     " << std::hex << header.ProtocolID
@@ -382,90 +472,128 @@ int ss_client_if::parse_header(char *buffer, uint32_t length) {
               << "\n   BodySize:     " << std::hex << header.BodySize
               << std::endl;
 */
-
-    length -= to_write;
-    buffer += to_write;
-    parser_position += to_write;
-    consumed += to_write;
-
     // limit message type
     header.MessageType = header.MessageType & 0xFFFF;
-    
-    if (parser_position == sizeof(MessageHeader)) {
-      parser_position = 0;
-      if (header.BodySize > 0) {
-        parser_phase = ReadingData;
-      }
 
-      return consumed;
+    parser_position = 0;
+    if (header.BodySize > 0) {
+      parser_phase = ReadingData;
     }
   }
 
-  return consumed;
+  return to_write;
 }
 
-int ss_client_if::parse_body(char* buffer, uint32_t length) {
-  auto consumed = 0;
-
-  while (length > 0) {
-    int to_write = std::min((int) header.BodySize - parser_position, length);
-    std::memcpy(body_buffer + parser_position, buffer, to_write);
-    length -= to_write;
-    buffer += to_write;
-    parser_position += to_write;
-    consumed += to_write;
+uint32_t ss_client_if::parse_body(const uint8_t *buffer, uint32_t length) {
+  uint32_t to_write = std::min(header.BodySize - parser_position, length);
+  std::memcpy(body_buffer + parser_position, buffer, to_write);
+  parser_position += to_write;
 
-    if (parser_position == header.BodySize) {
-      parser_position = 0;
-      parser_phase = AcquiringHeader;
-      return consumed;
-    }
+  if (parser_position == header.BodySize) {
+    parser_position = 0;
+    parser_phase = AcquiringHeader;
   }
 
-  return consumed;
+  return to_write;
 }
 
 bool ss_client_if::send_command(uint32_t cmd, std::vector<uint8_t> args) {
-  if (!is_connected) {
-    return false;
-  }
-
-  bool result;
-  uint32_t headerLen = sizeof(CommandHeader);
-  uint16_t argLen = args.size();
-  uint8_t *buffer = new uint8_t[headerLen + argLen];
+  queue_command(cmd, args);
+  return flush_commands(false);
+}
 
+void ss_client_if::queue_command(uint32_t cmd, const std::vector<uint8_t>& args) {
   CommandHeader header;
   header.CommandType = cmd;
-  header.BodySize = argLen;
+  header.BodySize = args.size();
+
+  const uint8_t *headerBytes = (const uint8_t *)&header;
+  m_pending_commands.insert(m_pending_commands.end(), headerBytes, headerBytes + sizeof(CommandHeader));
+  m_pending_commands.insert(m_pending_commands.end(), args.begin(), args.end());
+}
+
+bool ss_client_if::flush_commands(bool await_sync) {
+  if (m_batch_depth > 0) {
+    // end_batch() sends everything at once
+    m_batch_wants_sync = m_batch_wants_sync || await_sync;
+    return true;
+  }
 
-  for (uint32_t i=0; i<sizeof(CommandHeader); i++) {
-    buffer[i] = ((uint8_t *)(&header))[i];
+  if (m_pending_commands.empty()) {
+    return true;
   }
 
-  if (argLen > 0) {
-    for (uint16_t i=0; i<argLen; i++) {
-      buffer[i+headerLen] = args[i];
-    }
+  if (!is_connected) {
+    m_pending_commands.clear();
+    return false;
   }
 
+  uint64_t sync_seen;
+  {
+    std::lock_guard<std::mutex> lock(m_sync_lock);
+    sync_seen = m_sync_count;
+  }
+  bool result;
   try {
-//    std::cerr << "Sending command: " << cmd << " args: ";
-//    print_vec(args);
+//    std::cerr << "Sending commands: ";
+//    print_vec(m_pending_commands);
 //    std::cerr << std::endl;
-    client.send_data((char *)buffer, headerLen+argLen);
+    client.send_data((char *)&m_pending_commands[0], m_pending_commands.size());
     result = true;
   } catch (std::exception &e) {
     std::cerr << "caught exception while sending command.\n";
     result = false;
   }
+  m_pending_commands.clear();
 
-  delete[] buffer;
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // The server answers setting changes that affect tuning with a client
+  // sync block; waiting for it confirms the whole batch was applied.
+  if (result && await_sync && !wait_for_sync_after(sync_seen, m_sync_timeout_ms)) {
+    std::cerr << "SS_client_if: No client sync within " << m_sync_timeout_ms
+              << " ms of sending settings" << std::endl;
+  }
   return result;
 }
 
-void ss_client_if::handle_new_message() {
+bool ss_client_if::wait_for_sync(uint32_t timeout_ms) {
+  uint64_t seen;
+  {
+    std::lock_guard<std::mutex> lock(m_sync_lock);
+    seen = m_sync_count;
+  }
+  return wait_for_sync_after(seen, timeout_ms);
+}
+
+bool ss_client_if::wait_for_device_info(uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(m_sync_lock);
+  return m_sync_avail.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                               [&] { return (bool)got_device_info; });
+}
+
+void ss_client_if::set_sync_timeout(uint32_t timeout_ms) {
+  m_sync_timeout_ms = timeout_ms;
+}
+
+bool ss_client_if::wait_for_sync_after(uint64_t seen, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(m_sync_lock);
+  return m_sync_avail.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                               [&] { return m_sync_count > seen; });
+}
+
+void ss_client_if::begin_batch() {
+  ++m_batch_depth;
+}
+
+bool ss_client_if::end_batch() {
+  if (m_batch_depth == 0 || --m_batch_depth > 0) {
+    return true;
+  }
+  bool await_sync = m_batch_wants_sync;
+  m_batch_wants_sync = false;
+  return flush_commands(await_sync);
+}
+
+void ss_client_if::handle_new_message(const uint8_t *body) {
 
   if (terminated) {
     return;
@@ -473,22 +601,28 @@ void ss_client_if::handle_new_message() {
 
   switch (header.MessageType) {
     case MSG_TYPE_DEVICE_INFO:
-      process_device_info();
+      process_device_info(body);
       break;
     case MSG_TYPE_CLIENT_SYNC:
-      process_client_sync();
+      process_client_sync(body);
       break;
     case MSG_TYPE_UINT8_IQ:
-      if( m_do_iq ) process_uint8_samples();
+      if( m_do_iq ) process_uint8_samples(body);
       break;
     case MSG_TYPE_INT16_IQ:
-      if( m_do_iq ) process_int16_samples();
+      if( m_do_iq ) process_int16_samples(body);
+      break;
+    case MSG_TYPE_INT24_IQ:
+      if( m_do_iq ) process_int24_samples(body);
       break;
     case MSG_TYPE_FLOAT_IQ:
-      if( m_do_iq ) process_float_samples();
+      if( m_do_iq ) process_float_samples(body);
       break;
     case MSG_TYPE_UINT8_FFT:
-      process_uint8_fft();
+      process_uint8_fft(body);
+      break;
+    case MSG_TYPE_DINT4_FFT:
+      process_dint4_fft(body);
       break;
     default:
       std::cerr << "BAD MESSAGE TYPE: " << header.MessageType << "\n";
@@ -496,9 +630,13 @@ void ss_client_if::handle_new_message() {
   }
 }
 
-void ss_client_if::process_device_info() {
-  std::memcpy(&device_info, body_buffer, sizeof(DeviceInfo));
-  got_device_info = true;
+void ss_client_if::process_device_info(const uint8_t *body) {
+  {
+    std::lock_guard<std::mutex> lock(m_sync_lock);
+    std::memcpy(&device_info, body, sizeof(DeviceInfo));
+    got_device_info = true;
+  }
+  m_sync_avail.notify_all();
 
   std::cerr << "\n**********\nDevice Info:" 
             << "\n   Type:                 " << device_info.DeviceType
@@ -530,9 +668,12 @@ void ss_client_if::get_sampling_info( uint32_t& max_rate, uint32_t& decim_stages
    }
 }
 
-void ss_client_if::process_client_sync() {
+void ss_client_if::process_client_sync(const uint8_t *body) {
 
-  std::memcpy(&m_cur_client_sync, body_buffer, sizeof(ClientSync));
+  {
+    std::lock_guard<std::mutex> lock(m_sync_lock);
+    std::memcpy(&m_cur_client_sync, body, sizeof(ClientSync));
+  }
 
   _gain = (double) m_cur_client_sync.Gain;
   _center_freq = (double) m_cur_client_sync.IQCenterFrequency;
@@ -552,143 +693,124 @@ void ss_client_if::process_client_sync() {
             << std::endl;
 
   got_sync_info = true;
+
+  {
+    std::lock_guard<std::mutex> lock(m_sync_lock);
+    ++m_sync_count;
+  }
+  m_sync_avail.notify_all();
 }
 
-inline uint32_t ss_client_if::fifo_free(void) {
-   int32_t head = m_fifo_head;
-   int32_t tail =  m_fifo_tail;
-   int32_t size = m_fifo_size;
-   uint32_t avail;
-      
-   if( tail > head ) {
-      avail = tail - head;
-   } else {
-      avail = tail + (size - head);
+void ss_client_if::fifo_push(const uint8_t *body, uint32_t len) {
+   // memcpy works between server/client platforms of same endianness
+   // RaspPi armv7, x86, ARM64, all little-endian. Good for now. 
+   if( !_fifo->write(body, len) ) {
+      fifo_overflow();
+      return;
    }
-
-   return avail;
+   fifo_stamp();
 }
 
+void ss_client_if::fifo_overflow() {
+   // the consumer owns the tail, so a full ring drops the new frame
+   std::cerr << "O" << std::flush; // overflow notice
+   note_iq_gap(header.BodySize / wire_sample_bytes(m_sample_bits), true);
+}
 
-void ss_client_if::process_uint8_samples() {
-
-   _fifo_lock.lock();
+uint32_t ss_client_if::fifo_sample_bytes( uint8_t sample_bits ) {
+   // INT24 is unpacked to int32 on the way in
+   return sample_bits == 8 ? 2 : sample_bits == 16 ? 4 : 8;
+}
 
-   uint8_t *sample = (uint8_t *)body_buffer;
+uint32_t ss_client_if::wire_sample_bytes( uint8_t sample_bits ) {
+   return sample_bits == 8 ? 2 : sample_bits == 16 ? 4 : sample_bits == 24 ? 6 : 8;
+}
 
-//   std::cerr << "IN: tail\t" << m_fifo_tail << "\thead\t" << m_fifo_head << "\tfree\t" << fifo_free() << std::endl;
+uint64_t ss_client_if::min_fifo_size( uint8_t sample_bits, uint32_t batch_samples ) {
+   uint64_t frame = (uint64_t)SPYSERVER_MAX_MESSAGE_BODY_SIZE / wire_sample_bytes(sample_bits) *
+                    fifo_sample_bytes(sample_bits);
+   uint64_t batch = (uint64_t)batch_samples * fifo_sample_bytes(sample_bits);
+   return 2 * std::max(frame, batch);
+}
 
-   // check for overflow
-   if( fifo_free() < header.BodySize ) {
-      std::cerr << "O" << std::flush; // overflow notice
+void ss_client_if::note_iq_gap(uint64_t lost_samples, bool overflow) {
+   uint64_t index = _fifo->head() / fifo_sample_bytes(m_sample_bits);
+   if( m_pending_gap.lost_samples > 0 ) {
+      if( m_pending_gap.sample_index == index && m_pending_gap.overflow == overflow ) {
+         m_pending_gap.lost_samples += lost_samples;
+         return;
+      }
+      flush_iq_gap();
    }
+   m_pending_gap.sample_index = index;
+   m_pending_gap.lost_samples = lost_samples;
+   m_pending_gap.overflow = overflow;
+}
 
-   // byte fifo wrap
-   // if fifo size is 10,
-   // and head is 8 (next idx to write)
-   // and tail is 4 (next idx to read)
-   // then if 5 samples come in, we'll write 8, 9, 0, 1, 2 --> (8+5) % 10 = 3, new head
-   // if head == tail+1, we are full; if head > tail, we have overwritten tail and
-   // need to reset it to head
-
-   if( m_fifo_head + header.BodySize < m_fifo_size ) {
-      // non-wrap case
-      memcpy(&(_fifo[m_fifo_head]), sample, header.BodySize);
-   } else {
-      // wrap case
-      uint64_t to_copy = m_fifo_size - m_fifo_head; // e.g. 10 - 8 = 2 bytes to copy, idx 8 and 9
-//      uint64_t pval = (uint64_t)&(_fifo[0]);
-//      std::cerr << "local buffer:    " << std::hex << pval << " - " << pval + m_fifo_size << std::endl;
-//      pval = (uint64_t) sample;
-//      std::cerr << "incoming buffer: " << std::hex << pval << " - " << pval + header.BodySize << std::endl;
-      
-//      std::cerr << "part 1: copy 0x" <<  to_copy << " bytes from " << std::hex << pval << " - " << pval + to_copy << " to ";
-//      pval = (uint64_t)&(_fifo[m_fifo_head]);
-//      std::cerr << std::hex << pval << " - " << pval + to_copy << std::endl;
-      memcpy(&(_fifo[m_fifo_head]), sample, to_copy);
-
-      // remainder
-      sample += to_copy; // advance by previous amount copied
-      to_copy = header.BodySize - to_copy;
-//      pval = (uint64_t)sample;
-//      std::cerr << "part 2: copy 0x" << to_copy << " bytes from " << std::hex << pval << " - " << pval + to_copy << " to ";
-//      pval = (uint64_t)&(_fifo[0]);
-//      std::cerr << std::hex << pval << " - " << pval + to_copy << std::dec << std::endl;
-
-      memcpy(&(_fifo[0]), sample, to_copy);
+void ss_client_if::flush_iq_gap() {
+   if( m_pending_gap.lost_samples > 0 ) {
+      // best effort, like the frame stamps
+      m_iq_gaps.push(m_pending_gap);
+      m_pending_gap.lost_samples = 0;
    }
-   
-   // in all cases, head is now here:   
-   m_fifo_head = (m_fifo_head + header.BodySize) % m_fifo_size;
-
-//   std::cerr << "    tail\t" << m_fifo_tail << "\thead\t" << m_fifo_head << "\tfree\t" << fifo_free() << std::endl;
+}
 
-   _fifo_lock.unlock();
-   _samp_avail.notify_one();
+bool ss_client_if::next_iq_gap( iq_gap& gap ) {
+   const iq_gap* front = m_iq_gaps.front();
+   if( NULL == front ) {
+      return false;
+   }
+   gap = *front;
+   m_iq_gaps.pop();
+   return true;
+}
 
+DeviceInfo ss_client_if::get_device_info() {
+   std::lock_guard<std::mutex> lock(m_sync_lock);
+   return device_info;
 }
 
-void ss_client_if::process_int16_samples() {
+ClientSync ss_client_if::get_client_sync() {
+   std::lock_guard<std::mutex> lock(m_sync_lock);
+   return m_cur_client_sync;
+}
 
-   _fifo_lock.lock();
+void ss_client_if::fifo_stamp() {
+   flush_iq_gap();
+   // best effort: if the consumer falls far behind, stamps are skipped
+   m_frame_stamps.push({ _fifo->head(), m_rx_time });
+}
 
-   int16_t *sample = (int16_t *)body_buffer;
+void ss_client_if::process_uint8_samples(const uint8_t *body) {
+   fifo_push(body, header.BodySize);
+}
 
-/*
-   std::cerr << "IN: "
-             << header.BodySize << "B "
-             << header.BodySize / 2 / 2 << " samps\ttail\t" 
-             << m_fifo_tail << "\thead\t" 
-             << m_fifo_head << "\tfree\t" 
-             << fifo_free() << std::endl;
-*/
-   
-   // check for overflow
-   if( fifo_free() < header.BodySize ) {
-      std::cerr << "O" << std::flush; // overflow notice
-   }
+void ss_client_if::process_int16_samples(const uint8_t *body) {
+   fifo_push(body, header.BodySize);
+}
 
-   // byte fifo wrap
-   // if fifo size is 10,
-   // and head is 8 (next idx to write)
-   // and tail is 4 (next idx to read)
-   // then if 5 samples come in, we'll write 8, 9, 0, 1, 2 --> (8+5) % 10 = 3, new head
-   // if head == tail, we are full; if head > tail, we have overwritten tail and
-   // need to reset it to head
-
-//   uint32_t copy_samps = header.BodySize / 2;
-   if( m_fifo_head + header.BodySize < m_fifo_size ) {
-      // non-wrap case
-      // memcpy works between server/client platforms of same endianness
-      // RaspPi armv7, x86, ARM64, all little-endian. Good for now. 
-      memcpy(&(_fifo[m_fifo_head]), body_buffer, header.BodySize);
-   } else {
-      // wrap case
-      int64_t to_copy = m_fifo_size - m_fifo_head;
-      memcpy(&(_fifo[m_fifo_head]), sample, to_copy);
-
-      uint8_t* src = (uint8_t*)sample;
-      src += (m_fifo_size - m_fifo_head);
-      to_copy = header.BodySize - (m_fifo_size - m_fifo_head);
-      memcpy(&(_fifo[0]), src, to_copy);
-      
+void ss_client_if::process_int24_samples(const uint8_t *body) {
+   // the consumer sees cs32, so unpack straight into the ring instead of
+   // staging the converted frame somewhere first
+   uint32_t samples = header.BodySize / 3;
+   uint8_t *dst = _fifo->reserve(samples * sizeof(int32_t));
+   if( !dst ) {
+      fifo_overflow();
+      return;
    }
-   
-   // in all cases, head is now here:   
-   m_fifo_head = (m_fifo_head + header.BodySize) % m_fifo_size;
-   
-//   std::cerr << "after in:    tail\t" << m_fifo_tail << "\thead\t" << m_fifo_head << "\tfree\t" << fifo_free() << std::endl;
-
-   _fifo_lock.unlock();
-   _samp_avail.notify_one();
-
+   unpack_int24(body, (int32_t *)dst, samples);
+   _fifo->commit(samples * sizeof(int32_t));
+   fifo_stamp();
 }
 
-void ss_client_if::process_float_samples() {
+void ss_client_if::process_float_samples(const uint8_t *body) {
+   // cf32 goes into the FIFO exactly as it came off the wire
+   fifo_push(body, header.BodySize);
 }
 
 void ss_client_if::set_stream_state() {
   set_setting(SETTING_STREAMING_ENABLED, {(unsigned int)(streaming ? 1 : 0)});
+  flush_commands(false);
 }
 
 bool ss_client_if::set_sample_rate_by_decim_stage(const uint32_t decim_stage) {
@@ -766,7 +888,8 @@ bool ss_client_if::set_sample_rate_by_index(uint32_t requested_idx) {
 */
    }
 
-   return true;
+   // decimation changes come back in a client sync block
+   return flush_commands(true);
 }
 
 bool ss_client_if::set_sample_rate(double sampleRate) {
@@ -806,6 +929,8 @@ bool ss_client_if::set_center_freq(double centerFrequency, size_t chan) {
    bool ret1 = true;
    bool ret2 = true;
    
+   // send both retunes in one write and wait for a single client sync
+   begin_batch();
    if( m_do_fft == 1 ) {
       ret1 = set_fft_center_freq( centerFrequency, chan );
       ret2 = set_iq_center_freq( centerFrequency, chan );
@@ -813,7 +938,8 @@ bool ss_client_if::set_center_freq(double centerFrequency, size_t chan) {
    if( m_do_iq == 1 ) {
       ret2 = set_iq_center_freq( centerFrequency, chan );
    }
-   return ret1 && ret2;
+   bool sent = end_batch();
+   return ret1 && ret2 && sent;
 }
 
 bool ss_client_if::set_iq_center_freq(double centerFrequency, size_t chan) {
@@ -848,7 +974,7 @@ bool ss_client_if::set_iq_center_freq(double centerFrequency, size_t chan) {
    send_stream_format_commands();
    
    // can't know if this actually succeeded until updated client sync block arrives
-   return true;
+   return flush_commands(true);
 }
 
 bool ss_client_if::set_fft_center_freq(double centerFrequency, size_t chan) {
@@ -881,21 +1007,22 @@ bool ss_client_if::set_fft_center_freq(double centerFrequency, size_t chan) {
    send_stream_format_commands();
 
    // can't know if this actually succeeded until updated client sync block arrives
-   return true;
+   return flush_commands(true);
 }
 
-void ss_client_if::process_uint8_fft() {
+void ss_client_if::process_uint8_fft(const uint8_t *body) {
 
-   size_t num_pts = header.BodySize;
-   uint8_t* val = (uint8_t*)body_buffer;
+   // get_fft_data() swaps the sums under the lock, so size by m_fft_bins,
+   // which both sum vectors always match, rather than reading either here
+   size_t num_pts = std::min((size_t)header.BodySize, (size_t)m_fft_bins);
 
 //   std::cerr << "Got " << num_pts << " FFT points\n";
 
    m_fft_data_lock.lock();
-   for (size_t i = 0; i < num_pts; ++i)
-   {
-      m_fft_bin_sums[i] += *val;
-      ++val;
+   if( m_fft_linear ) {
+      accumulate_power_uint8(body, m_fft_power_lut, m_fft_power_sums.data(), num_pts);
+   } else {
+      accumulate_uint8(body, m_fft_bin_sums.data(), num_pts);
    }
    ++m_fft_count;
    m_fft_data_lock.unlock();
@@ -903,24 +1030,78 @@ void ss_client_if::process_uint8_fft() {
          
 }
 
+void ss_client_if::process_dint4_fft(const uint8_t *body) {
+
+   // two bins per byte, half the bandwidth of a uint8 frame
+   size_t num_pts = std::min((size_t)header.BodySize * 2, (size_t)m_fft_bins);
+
+   m_fft_data_lock.lock();
+   if( m_fft_linear ) {
+      accumulate_power_dint4(body, m_fft_power_lut, m_fft_power_sums.data(), num_pts);
+   } else {
+      accumulate_dint4(body, m_fft_bin_sums.data(), num_pts);
+   }
+   ++m_fft_count;
+   m_fft_data_lock.unlock();
+   m_fft_avail.notify_one();
+}
+
+double ss_client_if::fft_bin_to_db( double v ) const {
+   // the server maps [offset - range, offset] dB onto 0..255
+   return (double)m_fft_db_offset - m_fft_db_range + v * m_fft_db_range / 255.0;
+}
+
+void ss_client_if::build_fft_power_lut() {
+   for( int v = 0; v < 256; ++v ) {
+      m_fft_power_lut[v] = std::pow(10.0, fft_bin_to_db(v) / 10.0);
+   }
+}
+
+void ss_client_if::set_fft_linear_power( bool enable ) {
+   std::lock_guard<std::mutex> lock(m_fft_data_lock);
+   m_fft_linear = enable;
+   if( m_fft_linear ) {
+      build_fft_power_lut();
+      m_fft_power_sums.assign(m_fft_bins, 0);
+   }
+}
+
 void ss_client_if::get_fft_data( std::vector<uint32_t>& outdata, int& outperiods ) {
 
+   // The caller's vector becomes the next accumulation buffer, so clear it
+   // before taking the lock; after the first call this neither allocates
+   // nor frees, and the receive thread is only held off for the swap.
+   outdata.assign(m_fft_bins, 0);
+
    std::unique_lock<std::mutex> lock(m_fft_data_lock);
 
    while( 0 == m_fft_count ) {
       m_fft_avail.wait(lock);
    }
 
-   outdata = m_fft_bin_sums;
+   outdata.swap(m_fft_bin_sums);
    outperiods = m_fft_count;
-   
-   m_fft_bin_sums.clear();
-   m_fft_bin_sums.resize(m_fft_bins);
    m_fft_count = 0;   
    
    // unique lock automatically unlocks
 }
 
+void ss_client_if::get_fft_power( std::vector<float>& outdata, int& outperiods ) {
+
+   // same hand-off as get_fft_data()
+   outdata.assign(m_fft_bins, 0);
+
+   std::unique_lock<std::mutex> lock(m_fft_data_lock);
+
+   while( 0 == m_fft_count ) {
+      m_fft_avail.wait(lock);
+   }
+
+   outdata.swap(m_fft_power_sums);
+   outperiods = m_fft_count;
+   m_fft_count = 0;
+}
+
 
 ss_client_if::~ss_client_if ()
 {
@@ -959,60 +1140,72 @@ bool ss_client_if::stop()
 }
 
 template <class T>
-int ss_client_if::get_iq_data( const int batch_size,
-                                      T* out_array ) {
+iq_span<T> ss_client_if::acquire_iq( const int min_samples ) {
 
+   iq_span<T> span = { NULL, 0 };
    if ( !streaming || !m_do_iq) {
-      return 0;
+      return span;
    }
-//   std::cerr << "ss_client_if::get_iq_data: sizeof(T)=" << sizeof(T) << std::endl;
-   std::unique_lock<std::mutex> lock(_fifo_lock);
 
-   // if size is 10, head is 3, and tail is 5, bytes
-   // 5, 6, 7, 8, 9, 0, 1, 2 are available (8 bytes)
-   // 3 - 5 = -2 + 10 = 8
-   // this doesn't work if size > int32_t max
+   // units below are all bytes except for min_samples, which is 'samples'
    // each sample counts as I + Q, so two values, each sizeof(T) bytes long
-   int32_t samps_avail = ((m_fifo_size - fifo_free()) / 2) / sizeof(T);
-   
-   // don't peg the cpu checking, but don't wait too long beteween checks.
-   // max_wait is how long it should take to receive a complete batch.
-   unsigned int max_wait = (((double)batch_size / m_iq_sample_rate) * 1000) / 3;
-//   std::cerr << "batch size: " << batch_size << "   iq_samp_rate: " << m_iq_sample_rate << std::endl;
-//   std::cerr << "max_wait for iq data check is " << max_wait << "ms\n";
-   while (samps_avail < batch_size ) {
-//      std::cerr << "   Waiting with " << samps_avail << " samples available, want " << batch_size << std::endl;
-      _samp_avail.wait(lock);
-      samps_avail = ((m_fifo_size - fifo_free()) / 2) / sizeof(T);
-      std::this_thread::sleep_for(std::chrono::milliseconds(max_wait));
+   const size_t sample_bytes = sizeof(T) * 2;
+   size_t min_bytes = std::min(min_samples * sample_bytes, _fifo->size());
+
+   if( _fifo->used() < min_bytes ) {
+      // the producer wakes us as soon as the watermark is reached; in
+      // low-latency mode a timeout hands back a partial batch instead
+      std::chrono::milliseconds timeout(m_low_latency ? m_low_latency_timeout_ms : 100);
+      while( !_fifo->wait_for_data(min_bytes, timeout) ) {
+         if( !streaming ) {
+            return span;
+         }
+         if( m_low_latency && _fifo->used() >= sample_bytes ) {
+            break;
+         }
+      }
    }
 
-//   std::cerr << "   Releasing with " << samps_avail << " samples available, want " << batch_size << std::endl;
-//   std::cerr << "OUT: tail\t" << m_fifo_tail << "\thead\t" << m_fifo_head << "\tfree\t" << fifo_free() << std::endl;
-
-   // if size is 10, tail is 5, and batch is 5, OK
-   // 5 + 5 = 10 (read 5, 6, 7, 8, 9 and reset tail)
-   // but if batch is 6, wrap
-   // 5 + 6 = 11
-   // in both cases new tail is tail + batch_size % size
+   // the ring is double-mapped, so everything queued is contiguous
+   span.data = (const T*)_fifo->read_ptr();
+   span.samples = _fifo->used() / sample_bytes;
+   record_iq_latency(_fifo->tail() + span.samples * sample_bytes);
+   return span;
+}
 
-   // units below are all bytes except for batch_size, which is 'samples'
-   uint32_t batch_bytes = (batch_size * sizeof(T)) * 2;
-   if( m_fifo_tail + batch_bytes <= m_fifo_size ) {
-      // non-wrap case
-      memcpy(out_array, &(_fifo[m_fifo_tail]), batch_bytes);
-   } else {
-      uint8_t* dst = (uint8_t*)out_array;
-      memcpy(dst, &(_fifo[m_fifo_tail]), m_fifo_size - m_fifo_tail);
-      memcpy(dst + (m_fifo_size - m_fifo_tail),
-             &(_fifo[0]),
-             batch_bytes - (m_fifo_size - m_fifo_tail));
+void ss_client_if::record_iq_latency(uint64_t fifo_end) {
+   // every frame wholly inside the span handed out is now with the consumer
+   auto now = std::chrono::steady_clock::now();
+   const frame_stamp* stamp;
+   while( (stamp = m_frame_stamps.front()) != NULL && stamp->fifo_end <= fifo_end ) {
+      m_iq_latency.add(std::chrono::duration_cast<std::chrono::microseconds>(now - stamp->arrival).count());
+      m_frame_stamps.pop();
    }
+}
 
-   // move tail   
-   m_fifo_tail = (m_fifo_tail + batch_bytes) % m_fifo_size;
+void ss_client_if::set_low_latency( bool enable, uint32_t timeout_ms ) {
+   m_low_latency = enable;
+   m_low_latency_timeout_ms = std::max(timeout_ms, 1u);
+}
 
-   return (batch_bytes / sizeof(T)) / 2;
+template <class T>
+void ss_client_if::release_iq( const int samples ) {
+   _fifo->consume(samples * sizeof(T) * 2);
+}
+
+template <class T>
+int ss_client_if::get_iq_data( const int batch_size,
+                                      T* out_array ) {
+
+//   std::cerr << "ss_client_if::get_iq_data: sizeof(T)=" << sizeof(T) << std::endl;
+   iq_span<T> span = acquire_iq<T>(batch_size);
+   int samps = std::min(span.samples, batch_size);
+   if( samps > 0 ) {
+      memcpy(out_array, span.data, samps * sizeof(T) * 2);
+      release_iq<T>(samps);
+   }
+
+   return samps;
 }
 
 double ss_client_if::get_sample_rate()
@@ -1049,6 +1242,7 @@ double ss_client_if::set_gain( double gain, size_t chan )
   if (m_cur_client_sync.CanControl) {
     _gain = gain;
     set_setting(SETTING_GAIN, {(uint32_t)gain});
+    flush_commands(true);
   } else {
     std::cerr << "SS_client_if: The server does not allow you to change the gains." << std::endl;
   }
@@ -1101,12 +1295,20 @@ uint32_t ss_client_if::get_fft_center_freq()
 void ss_client_if::send_stream_format_commands() {
    if( m_do_fft ) {
 //      std::cerr << "SS_client_if: Sending fft format command" << std::endl;
-      set_setting(SETTING_FFT_FORMAT, { STREAM_FORMAT_UINT8 });
+      if( m_fft_bits == 4 ) {
+         set_setting(SETTING_FFT_FORMAT, { STREAM_FORMAT_DINT4 });
+      } else {
+         set_setting(SETTING_FFT_FORMAT, { STREAM_FORMAT_UINT8 });
+      }
    }
 //   if( m_do_iq ) {
    if( 1 ) {
 //      std::cerr << "SS_client_if: Sending iq format command" << std::endl;
-      if( m_sample_bits == 16 ) {
+      if( m_sample_bits == 32 ) {
+         set_setting(SETTING_IQ_FORMAT, { STREAM_FORMAT_FLOAT });
+      } else if( m_sample_bits == 24 ) {
+         set_setting(SETTING_IQ_FORMAT, { STREAM_FORMAT_INT24 });
+      } else if( m_sample_bits == 16 ) {
          set_setting(SETTING_IQ_FORMAT, { STREAM_FORMAT_INT16 });
       } else {
          set_setting(SETTING_IQ_FORMAT, { STREAM_FORMAT_UINT8 });
@@ -1117,4 +1319,14 @@ void ss_client_if::send_stream_format_commands() {
 
 template int ss_client_if::get_iq_data<int16_t>(const int batch_size, int16_t* out_array);
 template int ss_client_if::get_iq_data<uint8_t>(const int batch_size, uint8_t* out_array);
+template int ss_client_if::get_iq_data<float>(const int batch_size, float* out_array);
+template int ss_client_if::get_iq_data<int32_t>(const int batch_size, int32_t* out_array);
+template iq_span<float> ss_client_if::acquire_iq<float>(const int min_samples);
+template iq_span<int32_t> ss_client_if::acquire_iq<int32_t>(const int min_samples);
+template iq_span<int16_t> ss_client_if::acquire_iq<int16_t>(const int min_samples);
+template iq_span<uint8_t> ss_client_if::acquire_iq<uint8_t>(const int min_samples);
+template void ss_client_if::release_iq<float>(const int samples);
+template void ss_client_if::release_iq<int32_t>(const int samples);
+template void ss_client_if::release_iq<int16_t>(const int samples);
+template void ss_client_if::release_iq<uint8_t>(const int samples);
 
@@ -22,6 +22,9 @@
 
 #include "spyserver_protocol.h"
 #include "tcp_client.h"
+#include "buffer_pool.h"
+#include "spsc_ring.h"
+#include "latency_histogram.h"
 
 //class ss_client_if;
 
@@ -37,6 +40,24 @@ void print_vec( std::vector<T>& outdata) {
    std::cerr.fill(oldfill);
 }
 
+// Read-only view of queued IQ samples, borrowed from the sample FIFO.
+// data holds 'samples' interleaved I/Q pairs and stays valid until the
+// matching release_iq() call.
+template <class T>
+struct iq_span {
+   const T* data;
+   int samples;
+};
+
+// A discontinuity in the IQ stream: frames the server sent that never
+// arrived (a SequenceNumber gap), or frames dropped here because the
+// sample FIFO was full.
+struct iq_gap {
+   uint64_t sample_index;  // position in the FIFO sample stream of the hole
+   uint64_t lost_samples;  // sized from the frame that arrived after it
+   bool overflow;          // dropped locally rather than lost upstream
+};
+
 class ss_client_if {
 public:
    
@@ -45,7 +66,10 @@ public:
                       const uint8_t  _do_iq,
                       const uint8_t  _do_fft,
                       const uint32_t _fft_points,
-                      const uint8_t  _sample_bits);
+                      const uint8_t  _sample_bits,
+                      const uint8_t  _fft_bits,
+                      const uint32_t _fifo_size = 10 * 1024 * 1024,
+                      const uint32_t _sync_timeout_ms = 1000);
 
    ~ss_client_if ();
 
@@ -54,8 +78,47 @@ public:
 
    template <class T>
    int get_iq_data( const int batch_size, T* output_items );
+
+   // Zero-copy access to the sample FIFO: acquire_iq() blocks until at
+   // least min_samples are queued and returns all of them in place;
+   // release_iq() hands the first n of those back to the producer.
+   template <class T>
+   iq_span<T> acquire_iq( const int min_samples );
+   template <class T>
+   void release_iq( const int samples );
+
+   // Smallest sample FIFO, in bytes, for sample_bits samples consumed in
+   // batches of batch_samples: two of the largest frames the server sends,
+   // as unpacked into the FIFO, and two batches. A smaller ring drops
+   // every frame that doesn't fit, or never reaches the batch watermark.
+   static uint64_t min_fifo_size( uint8_t sample_bits, uint32_t batch_samples );
+
+   // Low-latency consumer mode: instead of always waiting for a full
+   // batch, acquire_iq()/get_iq_data() return whatever is queued once
+   // timeout_ms passes without the batch watermark being reached.
+   void set_low_latency( bool enable, uint32_t timeout_ms );
+
+   // Oldest IQ stream gap not yet collected, in the order they happened.
+   // Sample indexes count from the first sample ever queued, i.e. they
+   // match samples taken through acquire_iq()/get_iq_data().
+   bool next_iq_gap( iq_gap& gap );
+
+   // Copies of the latest device info and client sync blocks
+   DeviceInfo get_device_info();
+   ClientSync get_client_sync();
    
+   // Waits for at least one FFT frame, then hands back the bin sums and
+   // the number of frames in them. outdata's storage is swapped in as the
+   // next accumulation buffer, so reuse the same vector between calls.
    void get_fft_data( std::vector<uint32_t>& outdata, int& outperiods );
+
+   // Linear power mode: FFT bins are converted from the server's dB scale
+   // to power as they arrive and summed as floats; read them with
+   // get_fft_power() instead of get_fft_data(). Set before start().
+   void set_fft_linear_power( bool enable );
+   void get_fft_power( std::vector<float>& outdata, int& outperiods );
+   // the dB value a uint8 FFT bin of value v stands for
+   double fft_bin_to_db( double v ) const;
    void get_sampling_info( uint32_t& max_rate, uint32_t& decim_stages );
 
    bool set_sample_rate( double rate );
@@ -79,9 +142,26 @@ public:
    double get_gain( size_t chan = 0 );
    double get_gain( const std::string & name, size_t chan = 0 );
 
+   // Settings are queued and sent in one write per public call. Between
+   // begin_batch() and end_batch() nothing is sent; end_batch() sends
+   // the lot and, if any of it retunes, waits for the next client sync.
+   void begin_batch();
+   bool end_batch();
+
+   // Block until the server sends its next client sync block / until
+   // device info has arrived; false on timeout. The constructor waits for
+   // both during connect, and retunes wait for their sync, using the
+   // timeout given to the constructor or set_sync_timeout().
+   bool wait_for_sync( uint32_t timeout_ms );
+   bool wait_for_device_info( uint32_t timeout_ms );
+   void set_sync_timeout( uint32_t timeout_ms );
+
+   // receive path buffer allocation counters
+   const buffer_pool::alloc_stats& get_rx_alloc_stats() const { return m_body_pool.get_stats(); }
+
 
 private:
-   static constexpr unsigned int BufferSize = 64 * 1024;
+   static constexpr unsigned int BufferSize = 256 * 1024;
    const uint32_t ProtocolVersion = SPYSERVER_PROTOCOL_VERSION;
    const std::string SoftwareID = std::string("gr-osmosdr");
    const std::string NameNoDevice = std::string("SpyServer - No Device");
@@ -95,6 +175,7 @@ private:
 
    void connect();
    void disconnect();
+   void print_rx_stats();
    void thread_loop();
    bool say_hello();
    void cleanup();
@@ -102,21 +183,36 @@ private:
 
    bool set_setting(uint32_t settingType, std::vector<uint32_t> params);
    bool send_command(uint32_t cmd, std::vector<uint8_t> args);
-   void parse_message(char *buffer, uint32_t len);
-   int parse_header(char *buffer, uint32_t len);
-   int parse_body(char *buffer, uint32_t len);
-   void process_device_info();
-   void process_client_sync();
-   void process_uint8_samples();
-   void process_int16_samples();
-   void process_float_samples();
-   void process_uint8_fft();
-   void handle_new_message();
+   void queue_command(uint32_t cmd, const std::vector<uint8_t>& args);
+   bool flush_commands(bool await_sync);
+   bool wait_for_sync_after(uint64_t seen, uint32_t timeout_ms);
+   void parse_message(const uint8_t *buffer, uint32_t len);
+   uint32_t parse_header(const uint8_t *buffer, uint32_t len);
+   uint32_t parse_body(const uint8_t *buffer, uint32_t len);
+   void check_header();
+   void release_body_buffer();
+   void dispatch_message(const uint8_t *body);
+   void process_device_info(const uint8_t *body);
+   void process_client_sync(const uint8_t *body);
+   void process_uint8_samples(const uint8_t *body);
+   void process_int16_samples(const uint8_t *body);
+   void process_int24_samples(const uint8_t *body);
+   void process_float_samples(const uint8_t *body);
+   void process_uint8_fft(const uint8_t *body);
+   void process_dint4_fft(const uint8_t *body);
+   void build_fft_power_lut();
+   void handle_new_message(const uint8_t *body);
    void set_stream_state();
    bool set_sample_rate_by_index(uint32_t requested_idx);
    void send_stream_format_commands();
 
-   uint32_t fifo_free(void);
+   void fifo_push(const uint8_t *body, uint32_t len);
+   void fifo_overflow();
+   void fifo_stamp();
+   void note_iq_gap(uint64_t lost_samples, bool overflow);
+   void flush_iq_gap();
+   static uint32_t fifo_sample_bytes( uint8_t sample_bits );
+   static uint32_t wire_sample_bytes( uint8_t sample_bits );
    
    std::atomic_bool terminated;
    std::atomic_bool streaming;
@@ -131,6 +227,7 @@ private:
    uint8_t *header_data;
    uint8_t *body_buffer;
    uint64_t body_buffer_length;
+   buffer_pool m_body_pool;
    uint32_t parser_position;
    uint32_t last_sequence_number;
 
@@ -144,21 +241,51 @@ private:
    uint32_t streaming_mode;
    uint32_t parser_phase;
 
-//   std::deque<_Tsz>* _fifo;
-   uint8_t* _fifo;
-   uint32_t m_fifo_head;
-   uint32_t m_fifo_tail;
+   std::vector<uint8_t> m_pending_commands;
+   uint32_t m_batch_depth;
+   bool m_batch_wants_sync;
+
+   // bumped by every client sync block the receiver processes; the lock
+   // also covers got_device_info/got_sync_info transitions
+   uint64_t m_sync_count;
+   uint32_t m_sync_timeout_ms;
+   std::mutex m_sync_lock;
+   std::condition_variable m_sync_avail;
+
+   // lock-free: the receiver thread produces, acquire_iq()/get_iq_data() consume
+   spsc_ring* _fifo;
    const uint32_t m_fifo_size;
+   bool m_low_latency;
+   uint32_t m_low_latency_timeout_ms;
+
+   // socket arrival time of each frame, keyed by the FIFO byte count at
+   // its end; drained by the consumer into m_iq_latency
+   struct frame_stamp {
+      uint64_t fifo_end;
+      std::chrono::steady_clock::time_point arrival;
+   };
+   std::chrono::steady_clock::time_point m_rx_time;
+   spsc_queue<frame_stamp, 4096> m_frame_stamps;
+
+   // gaps are merged while they keep landing on the same sample and only
+   // queued once samples flow again
+   iq_gap m_pending_gap;
+   spsc_queue<iq_gap, 1024> m_iq_gaps;
+   latency_histogram m_iq_latency;
+   void record_iq_latency(uint64_t fifo_end);
       
    std::vector<uint32_t> m_fft_bin_sums;
+   std::vector<float> m_fft_power_sums;
+   bool m_fft_linear;
+   uint32_t m_fft_db_offset;
+   uint32_t m_fft_db_range;
+   float m_fft_power_lut[256];
    uint32_t m_fft_count;
    uint32_t m_fft_period; // the number of ffts to be averaged and reported
    uint32_t m_fft_bins;
    std::condition_variable m_fft_avail;
 
-   std::mutex _fifo_lock;
    std::mutex m_fft_data_lock;
-   std::condition_variable _samp_avail;
 
    std::vector< std::pair<double, uint32_t> > _sample_rates;
    double m_iq_sample_rate;
@@ -169,6 +296,7 @@ private:
    uint8_t m_do_iq;
    uint8_t m_do_fft;
    uint8_t m_sample_bits;
+   uint8_t m_fft_bits;
 };
 
 #endif /* SS_CLIENT_IF_H */
@@ -36,6 +36,8 @@
 #else
 #   include <sys/socket.h>
 #   include <netinet/in.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
 #endif
 
 
@@ -45,8 +47,20 @@
 
 
 class tcp_client {
+public:
+    // Receive path counters, kept by receive_some() on the receiving thread
+    struct rx_stats {
+        uint64_t bytes = 0;
+        uint64_t syscalls = 0;  // recv() plus epoll_wait() calls
+        uint64_t wakeups = 0;   // returns from epoll_wait()
+        std::chrono::steady_clock::time_point start;
+    };
+
 private:
     int port;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    rx_stats stats;
     #ifdef _WIN32
     static std::atomic_bool initialized;
     static std::atomic_uint sockCount;
@@ -67,6 +81,13 @@ public:
     void send_data(char *data, int length);
     uint64_t available_data();
 
+    // Block until data arrives, then read as much as is buffered (up to
+    // length). Returns 0 without reading once interrupt() has been called.
+    long receive_some(char *data, int length);
+    // Wake a thread blocked in receive_some(); safe from any thread.
+    void interrupt();
+    const rx_stats& get_rx_stats() const { return stats; }
+
     inline void wait_for_data(uint64_t bytes, uint32_t timeout) {
         uint32_t checkTime = (int) time(NULL);
         while (available_data() < bytes) {
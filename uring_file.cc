@@ -0,0 +1,237 @@
+/*
+ * Minimal io_uring file writer.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring_file.h"
+
+uring_file::uring_file(int fd, unsigned depth, const std::vector<struct iovec>& buffers) :
+   m_fd(fd),
+   m_ring_fd(-1),
+   m_registered(false),
+   m_enters(0),
+   m_buffers(buffers),
+   m_sq_ring(MAP_FAILED),
+   m_sq_ring_size(0),
+   m_cq_ring(MAP_FAILED),
+   m_cq_ring_size(0),
+   m_sqes(MAP_FAILED),
+   m_sqes_size(0),
+   m_sq_entries(0)
+{
+   struct io_uring_params p;
+   memset(&p, 0, sizeof(p));
+   m_ring_fd = syscall(__NR_io_uring_setup, depth, &p);
+   if( m_ring_fd < 0 ) {
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "io_uring_setup failed: " + strerror(errno) );
+   }
+   m_sq_entries = p.sq_entries;
+
+   m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+      // one mapping serves both rings
+      m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+   }
+   m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ring_fd, IORING_OFF_SQ_RING);
+   if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+      m_cq_ring = m_sq_ring;
+   } else if( m_sq_ring != MAP_FAILED ) {
+      m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       m_ring_fd, IORING_OFF_CQ_RING);
+   }
+   m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+   if( m_cq_ring != MAP_FAILED ) {
+      m_sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ring_fd, IORING_OFF_SQES);
+   }
+   if( m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED ) {
+      int err = errno;
+      cleanup();
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "Failed to map io_uring: " + strerror(err) );
+   }
+
+   char* sq = (char*)m_sq_ring;
+   m_sq_tail = (unsigned*)(sq + p.sq_off.tail);
+   m_sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+   m_sq_array = (unsigned*)(sq + p.sq_off.array);
+   char* cq = (char*)m_cq_ring;
+   m_cq_head = (unsigned*)(cq + p.cq_off.head);
+   m_cq_tail = (unsigned*)(cq + p.cq_off.tail);
+   m_cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+   m_cqes = cq + p.cq_off.cqes;
+
+   // Registered buffers skip the per-write page pinning, but they count
+   // against RLIMIT_MEMLOCK; without them IORING_OP_WRITE still works.
+   m_registered = (0 == syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_BUFFERS,
+                                m_buffers.data(), (unsigned)m_buffers.size()));
+   if( !m_registered && !op_supported(IORING_OP_WRITE) ) {
+      // 5.1 to 5.5 only have the fixed and vectored writes, and would
+      // fail every IORING_OP_WRITE with EINVAL
+      cleanup();
+      throw std::runtime_error( std::string(__FUNCTION__) + " " +
+                                "io_uring lacks IORING_OP_WRITE and buffers could not be registered" );
+   }
+}
+
+// Whether the kernel supports opcode op. The probe itself arrived with
+// IORING_OP_WRITE (5.6), so a kernel without it answers false.
+bool uring_file::op_supported(unsigned op)
+{
+   const unsigned ops = 256;
+   std::vector<char> mem(sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op), 0);
+   struct io_uring_probe* probe = (struct io_uring_probe*)mem.data();
+   if( 0 != syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, ops) ) {
+      return false;
+   }
+   return op <= probe->last_op && op < probe->ops_len &&
+          (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+uring_file::~uring_file()
+{
+   cleanup();
+}
+
+void uring_file::cleanup()
+{
+   if( m_sqes != MAP_FAILED ) {
+      munmap(m_sqes, m_sqes_size);
+      m_sqes = MAP_FAILED;
+   }
+   if( m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring ) {
+      munmap(m_cq_ring, m_cq_ring_size);
+   }
+   m_cq_ring = MAP_FAILED;
+   if( m_sq_ring != MAP_FAILED ) {
+      munmap(m_sq_ring, m_sq_ring_size);
+      m_sq_ring = MAP_FAILED;
+   }
+   if( m_ring_fd >= 0 ) {
+      close(m_ring_fd);
+      m_ring_fd = -1;
+   }
+}
+
+int uring_file::enter(unsigned to_submit, unsigned min_complete)
+{
+   int ret;
+   do {
+      ++m_enters;
+      ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete,
+                    IORING_ENTER_GETEVENTS, NULL, _NSIG / 8);
+   } while( ret < 0 && errno == EINTR );
+   return ret;
+}
+
+bool uring_file::write_all(const write_op* ops, size_t count)
+{
+   if( count > m_sq_entries ) {
+      errno = EINVAL;
+      return false;
+   }
+
+   // only this thread touches the SQ tail, so a plain read is fine
+   unsigned tail = *m_sq_tail;
+   unsigned mask = *m_sq_mask;
+   struct io_uring_sqe* sqes = (struct io_uring_sqe*)m_sqes;
+   for( size_t i = 0; i < count; ++i ) {
+      unsigned idx = tail & mask;
+      struct io_uring_sqe* sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = m_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+      sqe->fd = m_fd;
+      sqe->addr = (uint64_t)(uintptr_t)m_buffers[ops[i].buf_index].iov_base;
+      sqe->len = ops[i].len;
+      sqe->off = ops[i].offset;
+      sqe->buf_index = ops[i].buf_index;
+      sqe->user_data = i;
+      m_sq_array[idx] = idx;
+      ++tail;
+   }
+   // publish the entries before the kernel can see the new tail
+   __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+
+   bool ok = true;
+   int err = 0;
+   size_t submitted = 0;
+   size_t done = 0;
+   struct io_uring_cqe* cqes = (struct io_uring_cqe*)m_cqes;
+   while( done < count ) {
+      unsigned head = *m_cq_head;
+      unsigned cq_tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+      if( head == cq_tail ) {
+         int ret;
+         if( submitted < count ) {
+            // normally this submits the whole batch and waits for all of
+            // it; the kernel returns early if it takes fewer, leaving the
+            // rest queued in the SQ ring for the next call
+            ret = enter(count - submitted, count - done);
+            if( ret < 0 && (errno == EAGAIN || errno == EBUSY) && submitted > done ) {
+               // short of resources until some of the writes finish
+               if( enter(0, 1) < 0 ) {
+                  return false;
+               }
+               ret = 0;
+            }
+            if( ret < 0 ) {
+               // take back the entries the kernel never took, so they
+               // can't go out with a later batch, and finish the rest
+               ok = false;
+               err = errno;
+               __atomic_store_n(m_sq_tail, tail - (unsigned)(count - submitted), __ATOMIC_RELEASE);
+               count = submitted;
+               continue;
+            }
+            submitted += ret;
+         } else if( enter(0, count - done) < 0 ) {
+            return false;
+         }
+         continue;
+      }
+      for( ; head != cq_tail; ++head, ++done ) {
+         const struct io_uring_cqe* cqe = &cqes[head & *m_cq_mask];
+         const write_op& op = ops[cqe->user_data];
+         if( cqe->res < 0 ) {
+            ok = false;
+            err = -cqe->res;
+         } else if( (size_t)cqe->res < op.len ) {
+            // rare for regular files; finish it synchronously
+            const char* base = (const char*)m_buffers[op.buf_index].iov_base;
+            size_t pos = cqe->res;
+            while( pos < op.len ) {
+               ssize_t n = pwrite(m_fd, base + pos, op.len - pos, op.offset + pos);
+               if( n < 0 && errno == EINTR ) {
+                  continue;
+               }
+               if( n <= 0 ) {
+                  ok = false;
+                  err = n < 0 ? errno : EIO;
+                  break;
+               }
+               pos += n;
+            }
+         }
+      }
+      __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+   }
+
+   if( !ok ) {
+      errno = err;
+   }
+   return ok;
+}
@@ -0,0 +1,74 @@
+/*
+ * Minimal io_uring file writer.
+ *
+ * Talks to the kernel through the raw io_uring_setup/enter/register
+ * syscalls and <linux/io_uring.h>, so there is no liburing dependency.
+ * Only what iq_writer needs is here: a batch of writes from a fixed set
+ * of buffers, registered with the kernel up front when the memlock limit
+ * allows, submitted and reaped with a single io_uring_enter() per batch.
+ */
+#ifndef URING_FILE_H
+#define URING_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+
+class uring_file {
+public:
+   struct write_op {
+      unsigned buf_index;  // index into the buffers given to the constructor
+      size_t len;          // bytes to write from the start of that buffer
+      uint64_t offset;     // file offset
+   };
+
+   // Throws std::runtime_error when io_uring can't be set up (old
+   // kernel, seccomp, ...) or can't write from these buffers (no
+   // IORING_OP_WRITE before 5.6 and registration refused); callers fall
+   // back to plain writes.
+   uring_file(int fd, unsigned depth, const std::vector<struct iovec>& buffers);
+   ~uring_file();
+
+   uring_file(const uring_file&) = delete;
+   uring_file& operator=(const uring_file&) = delete;
+
+   unsigned depth() const { return m_sq_entries; }
+   bool registered() const { return m_registered; }
+   // io_uring_enter() calls made so far
+   uint64_t enters() const { return m_enters; }
+
+   // Write count ops (at most depth()) and wait for all of them. Short
+   // writes are completed with pwrite(). Returns false with errno set.
+   bool write_all(const write_op* ops, size_t count);
+
+private:
+   void cleanup();
+   bool op_supported(unsigned op);
+   int enter(unsigned to_submit, unsigned min_complete);
+
+   int m_fd;
+   int m_ring_fd;
+   bool m_registered;
+   uint64_t m_enters;
+   std::vector<struct iovec> m_buffers;
+
+   void* m_sq_ring;
+   size_t m_sq_ring_size;
+   void* m_cq_ring;
+   size_t m_cq_ring_size;
+   void* m_sqes;
+   size_t m_sqes_size;
+
+   unsigned m_sq_entries;
+   unsigned* m_sq_tail;
+   unsigned* m_sq_mask;
+   unsigned* m_sq_array;
+   unsigned* m_cq_head;
+   unsigned* m_cq_tail;
+   unsigned* m_cq_mask;
+   void* m_cqes;
+};
+
+#endif /* URING_FILE_H */